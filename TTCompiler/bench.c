@@ -0,0 +1,578 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+#include <stdint.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Benchmark for the compiler phases.
+// Generates a script of a given shape and size from a seed, then times
+// lexical_analyzer, convert_indents and syntactical_analyzer separately.
+// Every result is printed as one line of JSON so runs can be diffed across commits.
+// "ttcbench intern" instead hammers the intern pool from several threads at once.
+
+// Error, so exit the whole program
+void error(const char *format, ...) {
+	va_list argptr;
+	va_start(argptr, format);
+	printf("Error: ");
+	vprintf(format, argptr);
+	putchar('\n');
+	va_end(argptr);
+	exit(-1);
+}
+
+// ----- MEMORY -----
+
+// Peak resident set size of the whole process so far, in kilobytes
+long peak_rss_kb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+#endif
+}
+
+// ----- SCRIPT GENERATOR -----
+
+// xorshift64*, so the same seed makes the same script on every platform
+uint64_t random_state;
+
+uint32_t random_next() {
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Random number from 0 to limit-1
+int random_below(int limit) {
+	return random_next() % limit;
+}
+
+// Growable buffer the script is written into
+struct text_buffer {
+	char *data;
+	size_t length, capacity;
+};
+
+void text_append(struct text_buffer *text, const char *format, ...) {
+	va_list argptr;
+	while(1) {
+		size_t space = text->capacity - text->length;
+		va_start(argptr, format);
+		int needed = vsnprintf(text->data + text->length, space, format, argptr);
+		va_end(argptr);
+		if(needed >= 0 && (size_t)needed < space) {
+			text->length += needed;
+			return;
+		}
+		text->capacity = text->capacity * 2 + needed + 1;
+		text->data = (char*)realloc(text->data, text->capacity);
+		if(!text->data)
+			error("Can't allocate script buffer");
+	}
+}
+
+void text_indent(struct text_buffer *text, int level) {
+	for(int i=0; i<level; i++)
+		text_append(text, "\t");
+}
+
+const char *variable_names[] = {"x", "y", "n", "p", "i", "pos", "list", "tile", "player", "count", "wins", "name"};
+const char *builtin_names[] = {"@obj_add", "@obj_remove", "@tile_put", "@player_move", "@push", "@len", "@random", "@say", "@str"};
+const char *string_words[] = {"dirt", "bomb", "explosion", "water", "grass", "the winner is ", "wins", "lobby", "stone floor"};
+#define COUNT_OF(array) (int)(sizeof(array)/sizeof(array[0]))
+
+const char *random_variable() {
+	return variable_names[random_below(COUNT_OF(variable_names))];
+}
+
+// A single value: identifier, number, string or a small call
+void generate_factor(struct text_buffer *text, int depth) {
+	switch(random_below(depth > 2 ? 4 : 6)) {
+		case 0: case 1:
+			text_append(text, "%s", random_variable());
+			break;
+		case 2:
+			text_append(text, "%d", random_below(1000));
+			break;
+		case 3:
+			text_append(text, "\"%s\"", string_words[random_below(COUNT_OF(string_words))]);
+			break;
+		case 4:
+			text_append(text, "%s(%s, %d)", builtin_names[random_below(COUNT_OF(builtin_names))], random_variable(), random_below(100));
+			break;
+		case 5:
+			text_append(text, "(%s + %d)", random_variable(), random_below(10));
+			break;
+	}
+}
+
+// An expression with a given number of operators
+void generate_expression(struct text_buffer *text, int operators) {
+	static const char *operator_names[] = {"+", "-", "*", "/", "%", "+", "-"};
+	generate_factor(text, 0);
+	for(int i=0; i<operators; i++) {
+		text_append(text, " %s ", operator_names[random_below(COUNT_OF(operator_names))]);
+		generate_factor(text, 0);
+	}
+}
+
+// An array literal with a given number of elements
+void generate_array(struct text_buffer *text, int elements) {
+	text_append(text, "[");
+	for(int i=0; i<elements; i++) {
+		if(i)
+			text_append(text, ", ");
+		generate_factor(text, 3);
+	}
+	text_append(text, "]");
+}
+
+// One simple statement on its own line
+void generate_simple_statement(struct text_buffer *text, int level) {
+	text_indent(text, level);
+	switch(random_below(4)) {
+		case 0:
+			text_append(text, "var %s = ", random_variable());
+			generate_expression(text, random_below(4));
+			break;
+		case 1:
+			text_append(text, "%s = ", random_variable());
+			generate_expression(text, random_below(4));
+			break;
+		case 2:
+			text_append(text, "%s(%s, ", builtin_names[random_below(COUNT_OF(builtin_names))], random_variable());
+			generate_expression(text, random_below(2));
+			text_append(text, ")");
+			break;
+		case 3:
+			text_append(text, "return ");
+			generate_expression(text, random_below(2));
+			break;
+	}
+	text_append(text, "\n");
+}
+
+// The header of a block statement, the caller writes the body at level+1
+void generate_block_header(struct text_buffer *text, int level) {
+	text_indent(text, level);
+	switch(random_below(4)) {
+		case 0:
+			text_append(text, "if %s == %d:\n", random_variable(), random_below(10));
+			break;
+		case 1:
+			text_append(text, "while %s < %d:\n", random_variable(), random_below(100));
+			break;
+		case 2:
+			text_append(text, "for %s = %d to %s + %d:\n", random_variable(), random_below(10), random_variable(), random_below(10));
+			break;
+		case 3:
+			text_append(text, "for %s in %s:\n", random_variable(), random_variable());
+			break;
+	}
+}
+
+int function_number = 0;
+
+void generate_def_header(struct text_buffer *text) {
+	text_append(text, "def function_%d(", function_number++);
+	int parameters = random_below(4);
+	for(int i=0; i<parameters; i++)
+		text_append(text, i ? ", %s" : "%s", variable_names[i]);
+	text_append(text, "):\n");
+}
+
+// Each shape writes one top level item at a time until the size is reached
+void shape_defs(struct text_buffer *text) {
+	generate_def_header(text);
+	int statements = 1 + random_below(6);
+	for(int i=0; i<statements; i++) {
+		if(random_below(3) == 0) {
+			generate_block_header(text, 1);
+			generate_simple_statement(text, 2);
+		} else {
+			generate_simple_statement(text, 1);
+		}
+	}
+	text_append(text, "\n");
+}
+
+void shape_deep(struct text_buffer *text) {
+	// convert_indents only has room for 19 levels, and the def uses one
+	int depth = 8 + random_below(10);
+	generate_def_header(text);
+	for(int level=1; level<depth; level++) {
+		generate_simple_statement(text, level);
+		generate_block_header(text, level);
+	}
+	generate_simple_statement(text, depth);
+	text_append(text, "\n");
+}
+
+void shape_arrays(struct text_buffer *text) {
+	text_append(text, "var array_%d = ", function_number++);
+	generate_array(text, 100 + random_below(400));
+	text_append(text, "\n");
+}
+
+void shape_expressions(struct text_buffer *text) {
+	generate_def_header(text);
+	for(int i=0; i<4; i++) {
+		text_append(text, "\tvar %s = ", random_variable());
+		generate_expression(text, 50 + random_below(150));
+		text_append(text, "\n");
+	}
+	text_append(text, "\n");
+}
+
+void shape_comments(struct text_buffer *text) {
+	generate_def_header(text);
+	for(int i=0; i<8; i++) {
+		text_append(text, "\t# comment line %d: %s %s %s\n", i, string_words[random_below(COUNT_OF(string_words))],
+			string_words[random_below(COUNT_OF(string_words))], string_words[random_below(COUNT_OF(string_words))]);
+		if(random_below(3) == 0)
+			text_append(text, "\n# unindented comment in the middle of a function\n");
+		text_indent(text, 1);
+		text_append(text, "%s = %d # trailing comment\n", random_variable(), random_below(100));
+	}
+	text_append(text, "\n");
+}
+
+void shape_strings(struct text_buffer *text) {
+	generate_def_header(text);
+	for(int i=0; i<8; i++) {
+		text_append(text, "\t@say(");
+		int pieces = 1 + random_below(6);
+		for(int j=0; j<pieces; j++)
+			text_append(text, j ? " + \"%s %d\"" : "\"%s %d\"", string_words[random_below(COUNT_OF(string_words))], random_below(100000));
+		text_append(text, ")\n");
+	}
+	text_append(text, "\n");
+}
+
+void shape_mixed(struct text_buffer *text);
+
+struct script_shape {
+	const char *name;
+	void (*generate)(struct text_buffer *text);
+} script_shapes[] = {
+	{"defs",        shape_defs},
+	{"deep",        shape_deep},
+	{"arrays",      shape_arrays},
+	{"expressions", shape_expressions},
+	{"comments",    shape_comments},
+	{"strings",     shape_strings},
+	{"mixed",       shape_mixed},
+	{NULL, NULL}
+};
+
+void shape_mixed(struct text_buffer *text) {
+	// everything except "mixed" itself
+	script_shapes[random_below(6)].generate(text);
+}
+
+// Make a whole script of roughly the requested size
+void generate_script(struct text_buffer *text, struct script_shape *shape, size_t size, uint64_t seed) {
+	random_state = seed ? seed : 1;
+	function_number = 0;
+	text->length = 0;
+	text_append(text, "var playing = []\n");
+	while(text->length < size)
+		shape->generate(text);
+}
+
+// ----- HARNESS -----
+
+int count_nodes(struct syntax_node *node) {
+	int count = 0;
+	for(; node; node = node->next)
+		count += 1 + count_nodes(node->child);
+	return count;
+}
+
+int compare_doubles(const void *a, const void *b) {
+	double first = *(const double*)a, second = *(const double*)b;
+	return (first > second) - (first < second);
+}
+
+double median(double *values, int count) {
+	qsort(values, count, sizeof(double), compare_doubles);
+	return values[count/2];
+}
+
+void run_benchmark(struct script_shape *shape, size_t size, uint64_t seed, int runs) {
+	struct text_buffer text = {NULL, 0, 0};
+	generate_script(&text, shape, size, seed);
+
+	FILE *File = tmpfile();
+	if(!File)
+		error("Can't make a temporary file");
+	fwrite(text.data, 1, text.length, File);
+
+	double *times[PHASE_COUNT];
+	for(int phase=0; phase<PHASE_COUNT; phase++)
+		times[phase] = (double*)calloc(runs, sizeof(double));
+	int tokens = 0, symbols = 0, nodes = 0;
+	long pool_strings, pool_bytes, saved_before, saved_after;
+	intern_pool_stats(&pool_strings, &pool_bytes, &saved_before);
+
+	for(int run=0; run<runs; run++) {
+		rewind(File);
+
+		double start = stats_now();
+		struct lexeme_token *list = lexical_analyzer(File);
+		double lexed = stats_now();
+		convert_indents(list);
+		double converted = stats_now();
+		syntactical_analyzer(list);
+		double parsed = stats_now();
+
+		times[PHASE_LEX][run] = lexed - start;
+		times[PHASE_INDENT][run] = converted - lexed;
+		times[PHASE_PARSE][run] = parsed - converted;
+
+		tokens = 0;
+		for(struct lexeme_token *token = list; token; token = token->next)
+			tokens++;
+		symbols = 0;
+		for(struct symbol_data *symbol = symbol_table; symbol; symbol = symbol->next)
+			symbols++;
+		nodes = count_nodes(tree_head);
+
+		free_syntax_tree(tree_head);
+		tree_head = NULL;
+		free_token_list(list);
+		free_symbol_table();
+	}
+
+	intern_pool_stats(&pool_strings, &pool_bytes, &saved_after);
+	double lex_ns = median(times[PHASE_LEX], runs);
+	double indent_ns = median(times[PHASE_INDENT], runs);
+	double parse_ns = median(times[PHASE_PARSE], runs);
+	double total_ns = lex_ns + indent_ns + parse_ns;
+
+	printf("{\"shape\": \"%s\", \"seed\": %llu, \"bytes\": %lu, \"runs\": %d, "
+		"\"tokens\": %d, \"symbols\": %d, \"nodes\": %d, "
+		"\"lex_ns\": %.0f, \"indent_ns\": %.0f, \"parse_ns\": %.0f, "
+		"\"lex_bytes_per_sec\": %.0f, \"lex_tokens_per_sec\": %.0f, "
+		"\"indent_tokens_per_sec\": %.0f, \"parse_tokens_per_sec\": %.0f, \"parse_nodes_per_sec\": %.0f, "
+		"\"total_bytes_per_sec\": %.0f, \"intern_strings\": %ld, \"intern_bytes\": %ld, \"intern_saved_bytes\": %ld, "
+		"\"peak_rss_kb\": %ld}\n",
+		shape->name, (unsigned long long)seed, (unsigned long)text.length, runs,
+		tokens, symbols, nodes,
+		lex_ns, indent_ns, parse_ns,
+		text.length * 1e9 / lex_ns, tokens * 1e9 / lex_ns,
+		tokens * 1e9 / indent_ns, tokens * 1e9 / parse_ns, nodes * 1e9 / parse_ns,
+		text.length * 1e9 / total_ns, pool_strings, pool_bytes, saved_after - saved_before, peak_rss_kb());
+	fflush(stdout);
+
+	for(int phase=0; phase<PHASE_COUNT; phase++)
+		free(times[phase]);
+	fclose(File);
+	free(text.data);
+}
+
+// ----- INTERN POOL STRESS TEST -----
+// Every thread interns the same set of strings, each starting at a different
+// place in it, so lookups and inserts of the same strings race each other
+// and shards get grown while other threads are probing them. Some strings
+// are too big for a block and get one of their own; those are interned first,
+// so small ones then get added to shards that started with a big one.
+// Afterward every thread has to have gotten the same copy and ID for each
+// string, and the pool has to have exactly one of each. Build with
+// -fsanitize=thread to check the pool's locking as well.
+
+#define INTERN_BIG_EVERY  1000    // every this many strings is a big one
+#define INTERN_BIG_LENGTH 20000   // more than a quarter of a block
+
+int is_big_string(int index) {
+	return index % INTERN_BIG_EVERY == INTERN_BIG_EVERY - 1;
+}
+
+struct intern_thread {
+	pthread_t thread;
+	int index, thread_count;
+	int string_count;
+	char **strings;
+	const char **copies;          // what intern_string gave back for each string
+	int *ids;
+};
+
+void *intern_thread_run(void *argument) {
+	struct intern_thread *thread = (struct intern_thread*)argument;
+	int count = thread->string_count;
+	int start = (int)((long)count * thread->index / thread->thread_count);
+	// big ones first, so they're the first thing in each shard, then everything
+	for(int pass=0; pass<2; pass++)
+		for(int i=0; i<count; i++) {
+			// odd threads go backward, so they meet the even ones in the middle
+			int which = thread->index & 1 ? (start - i + count) % count : (start + i) % count;
+			if(pass == 0 && !is_big_string(which))
+				continue;
+			thread->copies[which] = intern_string(thread->strings[which], &thread->ids[which], NULL);
+		}
+	return NULL;
+}
+
+void run_intern_stress(int thread_count, int string_count) {
+	char **strings = (char**)malloc(string_count * sizeof(char*));
+	struct intern_thread *threads = (struct intern_thread*)calloc(thread_count, sizeof(struct intern_thread));
+	if(!strings || !threads)
+		error("Can't allocate stress test");
+	for(int i=0; i<string_count; i++) {
+		int big = is_big_string(i);
+		strings[i] = (char*)malloc(big ? INTERN_BIG_LENGTH + 16 : 16);
+		int length = sprintf(strings[i], "s%d", i);
+		if(big) {
+			memset(strings[i] + length, 'x', INTERN_BIG_LENGTH);
+			strings[i][length + INTERN_BIG_LENGTH] = 0;
+		}
+	}
+
+	intern_pool_free();
+	double start = stats_now();
+	for(int t=0; t<thread_count; t++) {
+		struct intern_thread *thread = &threads[t];
+		thread->index = t;
+		thread->thread_count = thread_count;
+		thread->string_count = string_count;
+		thread->strings = strings;
+		thread->copies = (const char**)calloc(string_count, sizeof(const char*));
+		thread->ids = (int*)calloc(string_count, sizeof(int));
+		if(!thread->copies || !thread->ids || pthread_create(&thread->thread, NULL, intern_thread_run, thread))
+			error("Can't start stress test thread");
+	}
+	for(int t=0; t<thread_count; t++)
+		pthread_join(threads[t].thread, NULL);
+	double finished = stats_now();
+
+	// one copy of each, everyone agrees on it, and its ID leads back to it
+	long wrong = 0;
+	char *id_used = (char*)calloc(string_count + 1, 1);
+	for(int i=0; i<string_count; i++) {
+		const char *copy = threads[0].copies[i];
+		int id = threads[0].ids[i];
+		if(!copy || strcmp(copy, strings[i]) || intern_text(id) != copy || id < 1 || id > string_count || id_used[id]++)
+			wrong++;
+		for(int t=1; t<thread_count; t++)
+			if(threads[t].copies[i] != copy || threads[t].ids[i] != id)
+				wrong++;
+	}
+	long pool_strings, pool_bytes, pool_saved;
+	intern_pool_stats(&pool_strings, &pool_bytes, &pool_saved);
+	if(pool_strings != string_count)
+		wrong++;
+
+	printf("{\"bench\": \"intern\", \"threads\": %d, \"strings\": %d, \"interns\": %ld, "
+		"\"intern_ns\": %.1f, \"pool_strings\": %ld, \"pool_bytes\": %ld, \"wrong\": %ld, \"peak_rss_kb\": %ld}\n",
+		thread_count, string_count, (long)thread_count * string_count,
+		(finished - start) / ((double)thread_count * string_count), pool_strings, pool_bytes, wrong, peak_rss_kb());
+
+	intern_pool_free();
+	for(int t=0; t<thread_count; t++) {
+		free(threads[t].copies);
+		free(threads[t].ids);
+	}
+	for(int i=0; i<string_count; i++)
+		free(strings[i]);
+	free(strings);
+	free(threads);
+	free(id_used);
+}
+
+void usage() {
+	puts("Usage: ttcbench [--shape name|all] [--size bytes] [--seed n] [--runs n] [--emit] [--no-intern]");
+	puts("       ttcbench intern [--threads n] [--strings n]");
+	printf("Shapes:");
+	for(struct script_shape *shape = script_shapes; shape->name; shape++)
+		printf(" %s", shape->name);
+	puts("\n--emit writes the generated script to stdout instead of timing it");
+	puts("intern interns the same strings from several threads at once and checks the pool");
+	exit(0);
+}
+
+int main(int argc, char *argv[]) {
+	const char *shape_name = "all";
+	size_t size = 256 * 1024;
+	uint64_t seed = 1;
+	int runs = 5;
+	int emit = 0;
+	int intern_stress = 0, threads = 8, strings = 200000;
+
+	for(int i=1; i<argc; i++) {
+		if(!strcmp(argv[i], "--shape") && i+1 < argc)
+			shape_name = argv[++i];
+		else if(!strcmp(argv[i], "--size") && i+1 < argc)
+			size = strtoul(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "--seed") && i+1 < argc)
+			seed = strtoull(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "--runs") && i+1 < argc)
+			runs = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--emit"))
+			emit = 1;
+		else if(!strcmp(argv[i], "--no-intern"))
+			use_intern_pool = 0;
+		else if(!strcmp(argv[i], "intern"))
+			intern_stress = 1;
+		else if(!strcmp(argv[i], "--threads") && i+1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--strings") && i+1 < argc)
+			strings = atoi(argv[++i]);
+		else
+			usage();
+	}
+	if(intern_stress) {
+		if(threads < 1 || strings < 1)
+			usage();
+		run_intern_stress(threads, strings);
+		return 0;
+	}
+	if(runs < 1)
+		runs = 1;
+
+	int found = 0;
+	for(struct script_shape *shape = script_shapes; shape->name; shape++) {
+		if(strcmp(shape_name, "all") && strcmp(shape_name, shape->name))
+			continue;
+		found = 1;
+		if(emit) {
+			struct text_buffer text = {NULL, 0, 0};
+			generate_script(&text, shape, size, seed);
+			fwrite(text.data, 1, text.length, stdout);
+			free(text.data);
+		} else {
+			run_benchmark(shape, size, seed, runs);
+		}
+	}
+	if(!found)
+		usage();
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- BUILTIN FUNCTIONS -----
+// Everything the host provides to scripts. -1 arguments means any number.
+// Calls to BUILTIN_MUTATES builtins are recorded in the invocation's command
+// buffer and applied together when the hook ends. BUILTIN_QUERIES calls apply
+// the buffer first if it has changes they could see.
+
+struct builtin_info builtins[] = {
+	// name                   arguments  returns                 flags
+	{"@tile_put",             3,         TYPE_NONE,              BUILTIN_MUTATES},
+	{"@obj_add",              3,         TYPE_NONE,              BUILTIN_MUTATES},
+	{"@obj_remove",           3,         TYPE_NONE,              BUILTIN_MUTATES},
+	{"@player_move",          3,         TYPE_NONE,              BUILTIN_MUTATES},
+	{"@player_at_xy",         2,         TYPE_LIST,              BUILTIN_QUERIES},
+	{"@player_who",           0,         TYPE_LIST,              BUILTIN_QUERIES},
+	{"@player_displayname",   1,         TYPE_STRING,            0},
+	{"@player_load",          3,         TYPE_ANY,               0},
+	{"@player_save",          3,         TYPE_NONE,              0},
+	{"@timer",                -1,        TYPE_NONE,              0},
+	{"@say",                  1,         TYPE_NONE,              0},
+	{"@str",                  1,         TYPE_STRING,            0},
+	{"@len",                  1,         TYPE_INTEGER,           0},
+	{"@random",               1,         TYPE_INTEGER,           0},
+	{"@clone",                1,         TYPE_SAME_AS_ARGUMENT,  0},
+	{"@push",                 2,         TYPE_NONE,              0},
+	{"@pop",                  1,         TYPE_ANY,               0},
+	{"@remove",               2,         TYPE_NONE,              0},
+	{"@remove_index",         2,         TYPE_NONE,              0},
+	{NULL}
+};
+
+// Find a builtin by name, or NULL if there isn't one
+struct builtin_info *find_builtin(const char *name) {
+	for(struct builtin_info *builtin = builtins; builtin->name; builtin++)
+		if(!strcmp(builtin->name, name))
+			return builtin;
+	return NULL;
+}
+
+// Flag the calls to builtins that change or read the map
+void mark_host_calls(struct syntax_node *node) {
+	for(; node; node = node->next) {
+		if(is_call(node)) {
+			struct builtin_info *builtin = find_builtin(node->token->symbol->lexeme);
+			if(builtin && (builtin->flags & BUILTIN_MUTATES)) {
+				node->flags |= NODE_DEFERRED;
+				STATS_ADD(deferred_calls, 1);
+			}
+			if(builtin && (builtin->flags & BUILTIN_QUERIES)) {
+				node->flags |= NODE_FLUSH;
+				STATS_ADD(flush_calls, 1);
+			}
+		}
+		mark_host_calls(node->child);
+	}
+}
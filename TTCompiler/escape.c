@@ -0,0 +1,299 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- ESCAPE ANALYSIS -----
+// Finds the lists and strings that can't outlive the hook invocation that
+// makes them, so the runtime can put them in the invocation's region and
+// free them all at once when the hook returns. Everything else goes on the
+// refcounted heap.
+//
+// A value escapes if it can end up in a global, in a @timer or @player_save
+// argument, in a list that escapes, or in what a hook returns to the host.
+// Calls between functions all happen inside the same invocation, so passing
+// a list to a function or returning it to the caller doesn't make it escape
+// by itself; each function gets a summary of which parameters escape and
+// whether its return value does, and everything is redone until nothing
+// changes. An allocation site whose value never escapes is flagged with
+// NODE_REGION.
+
+struct escape_summary {
+	unsigned int parameters;         // bit set for each parameter that escapes
+	int returns;                     // the return value escapes
+	struct symbol_data **locals;     // locals that escape
+	int local_count, local_capacity;
+};
+
+struct escape_summary *escape_summaries = NULL;
+int escape_summary_count;
+int escape_changed;
+int region_sites, heap_sites;
+
+// Builtins whose result is a newly made list or string
+const char *allocating_builtins[] = {
+	"@player_at_xy", "@player_who", "@player_displayname", "@str", "@clone", NULL
+};
+
+int allocates(const char *name) {
+	for(int i=0; allocating_builtins[i]; i++)
+		if(!strcmp(allocating_builtins[i], name))
+			return 1;
+	return 0;
+}
+
+// The ( or [ node under an identifier, if there is one
+struct syntax_node *find_child(struct syntax_node *node, int category) {
+	for(struct syntax_node *child = node->child; child; child = child->next)
+		if(child->token->token_category == category)
+			return child;
+	return NULL;
+}
+
+int local_escapes(int function, struct symbol_data *symbol) {
+	if(function < 0 || !is_local(&function_table[function], function_table[function].body->child, symbol))
+		return 1; // globals always escape
+	struct escape_summary *summary = &escape_summaries[function];
+	for(int i=0; i<summary->local_count; i++)
+		if(summary->locals[i] == symbol)
+			return 1;
+	return 0;
+}
+
+void mark_local_escapes(int function, struct symbol_data *symbol) {
+	if(local_escapes(function, symbol))
+		return;
+	struct escape_summary *summary = &escape_summaries[function];
+	if(summary->local_count == summary->local_capacity) {
+		summary->local_capacity = summary->local_capacity ? summary->local_capacity * 2 : 16;
+		summary->locals = (struct symbol_data**)realloc(summary->locals, summary->local_capacity * sizeof(struct symbol_data*));
+		if(!summary->locals)
+			error("Can't allocate escape summary");
+	}
+	summary->locals[summary->local_count++] = symbol;
+
+	// parameters that escape change what callers have to do
+	int index = 0;
+	for(struct syntax_node *parameter = function_table[function].parameter_list->child; parameter; parameter = parameter->next, index++)
+		if(parameter->token->symbol == symbol && index < 32)
+			summary->parameters |= 1u << index;
+	escape_changed = 1;
+}
+
+// Flag an allocation site as going in the region or on the heap
+void allocation_site(struct syntax_node *node, int escapes) {
+	if(escapes)
+		node->flags &= ~NODE_REGION;
+	else
+		node->flags |= NODE_REGION;
+}
+
+void flow(struct syntax_node *value, int escapes, int function);
+
+// Does a list that's named by this expression escape? Used for @push and x[i] = v
+int container_escapes(struct syntax_node *node, int function) {
+	if(node->token->token_category == t_identifier && !find_child(node, t_lparen))
+		return local_escapes(function, node->token->symbol);
+	return 1;
+}
+
+void call_arguments(struct syntax_node *call, int function) {
+	const char *name = call->token->symbol->lexeme;
+	struct syntax_node *arguments = find_child(call, t_lparen)->child;
+	int callee = find_function(name);
+
+	if(callee >= 0) {
+		int index = 0;
+		for(struct syntax_node *argument = arguments; argument; argument = argument->next, index++)
+			flow(argument, index >= 32 || (escape_summaries[callee].parameters & (1u << index)), function);
+	} else if(!strcmp(name, "@push") && arguments) {
+		flow(arguments, 0, function);
+		for(struct syntax_node *argument = arguments->next; argument; argument = argument->next)
+			flow(argument, container_escapes(arguments, function), function);
+	} else {
+		// the host copies what it's given, except for these
+		int kept = !find_builtin(name) || !strcmp(name, "@timer") || !strcmp(name, "@player_save");
+		for(struct syntax_node *argument = arguments; argument; argument = argument->next)
+			flow(argument, kept, function);
+	}
+}
+
+// A value goes somewhere that either escapes or doesn't
+void flow(struct syntax_node *value, int escapes, int function) {
+	if(!value)
+		return;
+	switch(value->token->token_category) {
+		case t_identifier: {
+			struct syntax_node *call = find_child(value, t_lparen);
+			struct syntax_node *index = find_child(value, t_lsquare);
+			if(call) {
+				const char *name = value->token->symbol->lexeme;
+				int callee = find_function(name);
+				if(callee >= 0 && escapes && !escape_summaries[callee].returns) {
+					escape_summaries[callee].returns = 1;
+					escape_changed = 1;
+				}
+				if(allocates(name))
+					allocation_site(value, escapes);
+				// these hand back something that's also still in their argument
+				if(escapes && (!strcmp(name, "@clone") || !strcmp(name, "@pop")) && call->child)
+					flow(call->child, 1, function);
+				call_arguments(value, function);
+			} else {
+				// reading an element out of a list lets the whole list's contents escape
+				if(escapes)
+					mark_local_escapes(function, value->token->symbol);
+				if(index)
+					flow(index->child, 0, function);
+			}
+			return;
+		}
+		case t_lsquare: // list literal
+			allocation_site(value, escapes);
+			for(struct syntax_node *element = value->child; element; element = element->next)
+				flow(element, escapes, function);
+			return;
+		case t_lparen: // parentheses
+			flow(value->child, escapes, function);
+			return;
+		case t_addsub:
+			// + on strings makes a new string, and the operands are only read
+			if(value->token->token_value == 1 && value->child && value->child->next && (value->type & TYPE_STRING))
+				allocation_site(value, escapes);
+			// but adding lists shares the elements
+			if(escapes && (value->type & TYPE_LIST)) {
+				for(struct syntax_node *child = value->child; child; child = child->next)
+					flow(child, 1, function);
+				return;
+			}
+			break;
+	}
+	for(struct syntax_node *child = value->child; child; child = child->next)
+		flow(child, 0, function);
+}
+
+void escape_statements(struct syntax_node *node, int function) {
+	for(; node; node = node->next) {
+		struct syntax_node *child = node->child;
+		switch(node->token->token_category) {
+			case t_def:
+				continue;
+			case t_var: // var -> name -> value
+				for(struct syntax_node *name = child; name; name = name->next)
+					flow(name->child, local_escapes(function, name->token->symbol), function);
+				continue;
+			case t_assignment: { // = -> target, value
+				int escapes = find_child(child, t_lsquare) ? container_escapes(child, function) : local_escapes(function, child->token->symbol);
+				struct syntax_node *index = find_child(child, t_lsquare);
+				if(index)
+					flow(index->child, 0, function);
+				flow(child->next, escapes, function);
+				continue;
+			}
+			case t_return:
+				flow(child, function < 0 || is_hook_name(function_table[function].name) || escape_summaries[function].returns, function);
+				continue;
+			case t_each_loop: // counter, list, body
+				flow(child->next, local_escapes(function, child->token->symbol), function);
+				escape_statements(child->next->next, function);
+				continue;
+			case t_range_loop: // counter, start, end, step, body
+				flow(child->next, 0, function);
+				flow(child->next->next, 0, function);
+				flow(child->next->next->next, 0, function);
+				escape_statements(child->next->next->next->next, function);
+				continue;
+			case t_if: case t_elif: case t_while: case t_until: // condition, body
+				flow(child, 0, function);
+				escape_statements(child->next, function);
+				continue;
+			case t_identifier: // call statement, the result goes nowhere
+				flow(node, 0, function);
+				continue;
+			case t_indent_in: case t_else:
+				escape_statements(child, function);
+				continue;
+		}
+		// anything else, like a for loop lowering left alone, is treated as escaping
+		for(; child; child = child->next)
+			flow(child, 1, function);
+	}
+}
+
+// Count up the allocation sites once everything has settled
+void count_sites(struct syntax_node *node, int in_identifier) {
+	for(; node; node = node->next) {
+		int category = node->token->token_category;
+		int site = (category == t_lsquare && !in_identifier)
+			|| (category == t_identifier && find_child(node, t_lparen) && allocates(node->token->symbol->lexeme))
+			|| (category == t_addsub && node->token->token_value == 1 && node->child && node->child->next && (node->type & TYPE_STRING));
+		if(site) {
+			if(node->flags & NODE_REGION)
+				region_sites++;
+			else
+				heap_sites++;
+		}
+		// a [ under an identifier is indexing, except under a var's names, where it's the initial value
+		if(category == t_var) {
+			for(struct syntax_node *name = node->child; name; name = name->next)
+				count_sites(name->child, 0);
+			continue;
+		}
+		count_sites(node->child, category == t_identifier);
+	}
+}
+
+void analyze_escapes(struct syntax_node *tree) {
+	STATS_BEGIN(PHASE_ESCAPE);
+	free_escape_summaries();
+	escape_summaries = (struct escape_summary*)calloc(function_count + 1, sizeof(struct escape_summary));
+	if(!escape_summaries)
+		error("Can't allocate escape summaries");
+	escape_summary_count = function_count;
+
+	do {
+		escape_changed = 0;
+		escape_statements(tree, -1);
+		for(int i=0; i<function_count; i++)
+			escape_statements(function_table[i].body->child, i);
+	} while(escape_changed);
+
+	region_sites = heap_sites = 0;
+	count_sites(tree, 0);
+	STATS_ADD(region_sites, region_sites);
+	STATS_ADD(heap_sites, heap_sites);
+
+	free_escape_summaries();
+	STATS_END(PHASE_ESCAPE);
+}
+
+// Also called if a compile stops partway through
+void free_escape_summaries() {
+	if(!escape_summaries)
+		return;
+	for(int i=0; i<escape_summary_count; i++)
+		free(escape_summaries[i].locals);
+	free(escape_summaries);
+	escape_summaries = NULL;
+}
+
+void print_escape_report(FILE *out) {
+	int total = region_sites + heap_sites;
+	fprintf(out, "%d of %d allocation sites can use the region (%.1f%%)\n", region_sites, total,
+		total ? region_sites * 100.0 / total : 0.0);
+}
@@ -0,0 +1,167 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- EXPORT TABLE -----
+// The host calls into a script through hooks with fixed names. Instead of
+// making the host look those names up every time an event happens, the
+// compiler finds them once and lists them by event ID, so the runtime can
+// keep an array of handlers per event.
+
+// Every hook the host knows about. Prefix hooks like use_item_ are one event,
+// and whatever comes after the prefix is the key (the item name).
+// The event IDs are in TTRuntime/events.h, which the runtime uses too.
+struct hook_info hooks[] = {
+	// name                event                arguments  prefix
+	{"place_tile_hook",    EVENT_PLACE_TILE,    4,         0},
+	{"player_join_hook",   EVENT_PLAYER_JOIN,   1,         0},
+	{"player_leave_hook",  EVENT_PLAYER_LEAVE,  1,         0},
+	{"game_start",         EVENT_GAME_START,    0,         0},
+	{"use_item_",          EVENT_USE_ITEM,      3,         1},
+	{NULL}
+};
+
+const char *event_names[EVENT_COUNT] = {
+	"place tile", "player join", "player leave", "game start", "use item",
+};
+
+struct export_info *export_table = NULL;
+int export_count = 0;
+
+// Find the hook a function name is for, or NULL if the host never calls it
+struct hook_info *find_hook(const char *name) {
+	for(struct hook_info *hook = hooks; hook->name; hook++) {
+		if(hook->prefix ? !strncmp(hook->name, name, strlen(hook->name)) && name[strlen(hook->name)]
+		                : !strcmp(hook->name, name))
+			return hook;
+	}
+	return NULL;
+}
+
+int is_hook_name(const char *name) {
+	return find_hook(name) != NULL;
+}
+
+// Sort by event, so each event's handlers are together
+int compare_exports(const void *a, const void *b) {
+	const struct export_info *export_a = (const struct export_info*)a;
+	const struct export_info *export_b = (const struct export_info*)b;
+	if(export_a->event != export_b->event)
+		return export_a->event - export_b->event;
+	return export_a->function - export_b->function;
+}
+
+// Make the export table from the function table, checking each hook takes the right arguments
+void build_export_table() {
+	STATS_BEGIN(PHASE_EXPORTS);
+	free(export_table);
+	export_table = (struct export_info*)calloc(function_count + 1, sizeof(struct export_info));
+	if(!export_table)
+		error("Can't allocate export table");
+	STATS_ALLOC((function_count + 1) * sizeof(struct export_info));
+	export_count = 0;
+
+	for(int i=0; i<function_count; i++) {
+		struct function_info *function = &function_table[i];
+		struct hook_info *hook = find_hook(function->name);
+		if(!hook)
+			continue;
+		if(function->parameters != hook->arguments)
+			error("%s takes %d arguments but the host calls it with %d, %s", function->name,
+				function->parameters, hook->arguments, offset_print(function->node->child->token->offset));
+
+		struct export_info *export = &export_table[export_count++];
+		export->event = hook->event;
+		export->key = hook->prefix ? function->name + strlen(hook->name) : NULL;
+		export->key_id = 0;
+		if(export->key && use_intern_pool)
+			export->key = intern_string(export->key, &export->key_id, NULL);
+		export->function = i;
+	}
+	qsort(export_table, export_count, sizeof(struct export_info), compare_exports);
+	STATS_END(PHASE_EXPORTS);
+}
+
+void print_export_table(FILE *out) {
+	for(int i=0; i<export_count; i++) {
+		struct export_info *export = &export_table[i];
+		fprintf(out, "event %d (%s", export->event, event_names[export->event]);
+		if(export->key)
+			fprintf(out, " \"%s\"", export->key);
+		if(export->key_id)
+			fprintf(out, " #%d", export->key_id);
+		fprintf(out, ") -> function %d, %s\n", export->function, function_table[export->function].name);
+	}
+	if(!export_count)
+		fprintf(out, "no hooks, the host can't call into this script\n");
+}
+
+// ----- GLOBALS -----
+// Top level variables, in slot order. When a script is reloaded the runtime
+// matches these up by name with the old version's, so their values survive.
+
+struct global_info *global_table = NULL;
+int global_count = 0;
+
+void build_global_table(struct syntax_node *tree) {
+	free(global_table);
+	global_table = NULL;
+	global_count = 0;
+	int capacity = 0;
+
+	for(struct syntax_node *node = tree; node; node = node->next) {
+		if(node->token->token_category != t_var)
+			continue;
+		// var -> name -> value, name -> value
+		for(struct syntax_node *name = node->child; name; name = name->next) {
+			const char *lexeme = name->token->symbol->lexeme;
+			int id = name->token->symbol->intern_id;
+			int i;
+			for(i=0; i<global_count; i++)
+				if(id ? global_table[i].name_id == id : !strcmp(global_table[i].name, lexeme))
+					break;
+			if(i < global_count)
+				error("Global %s is already declared, %s", lexeme, offset_print(name->token->offset));
+
+			if(global_count == capacity) {
+				capacity = capacity ? capacity * 2 : 16;
+				global_table = (struct global_info*)realloc(global_table, capacity * sizeof(struct global_info));
+				if(!global_table)
+					error("Can't allocate global table");
+				STATS_ALLOC(capacity * sizeof(struct global_info));
+			}
+			global_table[global_count].name = lexeme;
+			global_table[global_count].name_id = id;
+			global_table[global_count].node = name;
+			global_table[global_count].line = node_line(name);
+			global_count++;
+		}
+	}
+}
+
+void print_global_table(FILE *out) {
+	for(int i=0; i<global_count; i++) {
+		fprintf(out, "%d: %s", i, global_table[i].name);
+		if(global_table[i].name_id)
+			fprintf(out, " #%d", global_table[i].name_id);
+		fprintf(out, ", line %d\n", global_table[i].line);
+	}
+	if(!global_count)
+		fprintf(out, "no globals\n");
+}
@@ -0,0 +1,250 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- FUNCTION TABLE -----
+// Lists every def in the syntax tree, along with the sample points inside
+// each one: the loops that branch backwards and the calls. The runtime
+// checks its profiler flag and its fuel budget at exactly these points.
+
+struct function_info *function_table = NULL;
+int function_count = 0;
+struct sample_point *sample_points = NULL;
+int sample_point_count = 0;
+int function_capacity = 0, sample_point_capacity = 0;
+
+const char *sample_point_kinds[] = {"loop", "call"};
+
+// The line a node's token is on
+int node_line(struct syntax_node *node) {
+	int line, column;
+	source_position(node->token->offset, &line, &column);
+	return line;
+}
+
+// Finds the largest offset of any token in a list of nodes and their children
+int last_offset(struct syntax_node *node) {
+	int offset = 0;
+	for(; node; node = node->next) {
+		if(node->token && node->token->offset > offset)
+			offset = node->token->offset;
+		int child = last_offset(node->child);
+		if(child > offset)
+			offset = child;
+	}
+	return offset;
+}
+
+// Is this node an identifier followed by an argument list?
+int is_call(struct syntax_node *node) {
+	return node->token->token_category == t_identifier && node->child
+		&& node->child->token->token_category == t_lparen;
+}
+
+// Finds the function with a given name, or -1
+int find_function(const char *name) {
+	for(int i=0; i<function_count; i++)
+		if(!strcmp(function_table[i].name, name))
+			return i;
+	return -1;
+}
+
+void add_sample_point(struct syntax_node *node, int function, int kind) {
+	if(sample_point_count == sample_point_capacity) {
+		sample_point_capacity = sample_point_capacity ? sample_point_capacity * 2 : 64;
+		sample_points = (struct sample_point*)realloc(sample_points, sample_point_capacity * sizeof(struct sample_point));
+		if(!sample_points)
+			error("Can't allocate sample points");
+		STATS_ALLOC(sample_point_capacity * sizeof(struct sample_point));
+	}
+	struct sample_point *point = &sample_points[sample_point_count++];
+	point->function = function;
+	point->kind = kind;
+	point->node = node;
+	point->line = node_line(node);
+	function_table[function].sample_points++;
+}
+
+int add_function(struct syntax_node *def) {
+	if(function_count == function_capacity) {
+		function_capacity = function_capacity ? function_capacity * 2 : 16;
+		function_table = (struct function_info*)realloc(function_table, function_capacity * sizeof(struct function_info));
+		if(!function_table)
+			error("Can't allocate function table");
+		STATS_ALLOC(function_capacity * sizeof(struct function_info));
+	}
+	struct function_info *function = &function_table[function_count];
+	memset(function, 0, sizeof(struct function_info));
+
+	// def -> name -> ( parameters ) and {{ body }}
+	struct syntax_node *name = def->child;
+	function->name = name->token->symbol->lexeme;
+	function->name_id = name->token->symbol->intern_id;
+	function->node = def;
+	function->parameter_list = name->child;
+	function->body = name->child->next;
+	for(struct syntax_node *parameter = name->child->child; parameter; parameter = parameter->next)
+		function->parameters++;
+	function->first_line = node_line(def);
+	int column;
+	source_position(last_offset(def->child), &function->last_line, &column);
+	return function_count++;
+}
+
+// Walk through statements, keeping track of which function they're in
+void scan_functions(struct syntax_node *node, int function) {
+	for(; node; node = node->next) {
+		switch(node->token->token_category) {
+			case t_def:
+				scan_functions(node->child->child->next, add_function(node));
+				continue;
+			case t_while: case t_until: case t_for: case t_range_loop: case t_each_loop:
+				if(function >= 0)
+					add_sample_point(node, function, SAMPLE_LOOP);
+				break;
+			case t_identifier:
+				if(function >= 0 && is_call(node))
+					add_sample_point(node, function, SAMPLE_CALL);
+				break;
+		}
+		scan_functions(node->child, function);
+	}
+}
+
+// ----- COST ESTIMATES -----
+// A function without loops or recursion can only run so many steps, so
+// the scheduler can charge that much fuel up front and skip the checks.
+// A step is one syntax node; builtins count as one step plus their arguments.
+
+enum {
+	COST_UNKNOWN = -2,  // not estimated yet
+	COST_VISITING = -3, // being estimated, seeing it again means recursion
+};
+
+long function_cost(int function);
+
+// Steps for a list of nodes not counting what loops and calls inside it
+// do, since those get charged at their own sample points
+long straight_cost(struct syntax_node *node) {
+	long cost = 0;
+	for(; node; node = node->next) {
+		cost++;
+		switch(node->token->token_category) {
+			case t_def: case t_while: case t_until: case t_for: case t_range_loop: case t_each_loop:
+				continue;
+			case t_identifier:
+				if(is_call(node)) // still count the arguments
+					cost += straight_cost(node->child->child);
+				else
+					cost += straight_cost(node->child);
+				continue;
+		}
+		cost += straight_cost(node->child);
+	}
+	return cost;
+}
+
+// How much fuel a sample point uses each time it's reached
+long sample_point_steps(struct sample_point *point) {
+	if(point->kind == SAMPLE_LOOP) {
+		// one trip through the loop: everything below the loop node
+		return straight_cost(point->node->child);
+	}
+	int callee = -1;
+	if(point->node->token->symbol->lexeme[0] != '@')
+		callee = find_function(point->node->token->symbol->lexeme);
+	return 1 + (callee >= 0 ? function_table[callee].entry_steps : 0);
+}
+
+// Worst case steps for a list of nodes, or COST_UNBOUNDED
+long node_cost(struct syntax_node *node) {
+	long cost = 0;
+	for(; node; node = node->next) {
+		switch(node->token->token_category) {
+			case t_def: // defining a nested function doesn't run it
+				cost++;
+				continue;
+			case t_while: case t_until: case t_for: case t_range_loop: case t_each_loop:
+				return COST_UNBOUNDED;
+			case t_identifier:
+				if(is_call(node) && node->token->symbol->lexeme[0] != '@') {
+					int callee = find_function(node->token->symbol->lexeme);
+					// a function defined somewhere else could do anything
+					long callee_cost = callee >= 0 ? function_cost(callee) : COST_UNBOUNDED;
+					if(callee_cost == COST_UNBOUNDED)
+						return COST_UNBOUNDED;
+					cost += callee_cost;
+				}
+				break;
+		}
+		long child_cost = node_cost(node->child);
+		if(child_cost == COST_UNBOUNDED)
+			return COST_UNBOUNDED;
+		cost += 1 + child_cost;
+	}
+	return cost;
+}
+
+long function_cost(int function) {
+	struct function_info *info = &function_table[function];
+	if(info->cost == COST_VISITING)
+		return COST_UNBOUNDED;
+	if(info->cost != COST_UNKNOWN)
+		return info->cost;
+	info->cost = COST_VISITING;
+	info->cost = node_cost(info->body);
+	return info->cost;
+}
+
+// Build the function table for the syntax tree that was just parsed
+void build_function_table(struct syntax_node *tree) {
+	STATS_BEGIN(PHASE_FUNCTIONS);
+	function_count = 0;
+	sample_point_count = 0;
+	scan_functions(tree, -1);
+
+	for(int i=0; i<function_count; i++) {
+		function_table[i].cost = COST_UNKNOWN;
+		function_table[i].entry_steps = straight_cost(function_table[i].body);
+	}
+	for(int i=0; i<function_count; i++)
+		function_cost(i);
+	for(int i=0; i<sample_point_count; i++)
+		sample_points[i].steps = sample_point_steps(&sample_points[i]);
+	STATS_END(PHASE_FUNCTIONS);
+}
+
+// Prints the function table and the sample points
+void print_function_table(FILE *out) {
+	for(int i=0; i<function_count; i++) {
+		struct function_info *function = &function_table[i];
+		fprintf(out, "%s", function->name);
+		if(function->name_id)
+			fprintf(out, " #%d", function->name_id);
+		fprintf(out, " (%d parameters) lines %d-%d, %d sample points, ", function->parameters,
+			function->first_line, function->last_line, function->sample_points);
+		if(function->cost == COST_UNBOUNDED)
+			fprintf(out, "needs fuel checks\n");
+		else
+			fprintf(out, "at most %ld steps\n", function->cost);
+		for(int j=0; j<sample_point_count; j++)
+			if(sample_points[j].function == i)
+				fprintf(out, "   line %d: %s, %ld steps\n", sample_points[j].line, sample_point_kinds[sample_points[j].kind], sample_points[j].steps);
+	}
+}
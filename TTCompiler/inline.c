@@ -0,0 +1,324 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- INLINING -----
+// Builds a call graph between the defs, then replaces calls to small
+// functions with a copy of their body:
+//   f(a, b)  becomes  {{ var f.x = a, f.y = b  <body of f> }}
+// Parameters and locals of the copy get renamed to "function.name", which
+// can't clash with anything since identifiers can't have a dot in them.
+// Globals and functions the copy uses keep their names, so a call isn't
+// inlined if the caller has a local by one of those names.
+// Only calls made as statements to functions without a return are inlined,
+// so there's never a return value to deal with.
+//
+// After that, any def that can't be reached from a hook the host calls,
+// from the global statements, or from a reference like @timer(1, callback)
+// gets removed.
+
+int inline_max_nodes = 64; // biggest function body to inline, 0 to turn inlining off
+
+struct inline_record {
+	const char *callee;
+	const char *caller;
+	int line;
+};
+
+struct inline_record *inline_records = NULL;
+int inline_record_count = 0, inline_record_capacity = 0;
+const char **removed_functions = NULL;
+int removed_function_count = 0;
+
+// calls[caller * function_count + callee] is 1 if caller calls callee
+char *calls = NULL;
+
+// ----- CALL GRAPH -----
+
+// The user function an identifier node names, or -1
+int named_function(struct syntax_node *node) {
+	if(node->token->token_category != t_identifier)
+		return -1;
+	return find_function(node->token->symbol->lexeme);
+}
+
+// Note every function called or referenced under a node. Nested defs are their own functions
+void find_calls(struct syntax_node *node, int caller, char *uses) {
+	for(; node; node = node->next) {
+		if(node->token->token_category == t_def)
+			continue;
+		int callee = named_function(node);
+		if(callee >= 0)
+			uses[callee] = 1;
+		find_calls(node->child, caller, uses);
+	}
+}
+
+void build_call_graph() {
+	free(calls);
+	calls = (char*)calloc(function_count * function_count + 1, 1);
+	if(!calls)
+		error("Can't allocate call graph");
+	STATS_ALLOC(function_count * function_count + 1);
+	for(int i=0; i<function_count; i++)
+		find_calls(function_table[i].body, i, &calls[i * function_count]);
+}
+
+// Can function "from" end up calling function "to"?
+int reaches(int from, int to, char *visited) {
+	if(visited[from])
+		return 0;
+	visited[from] = 1;
+	for(int i=0; i<function_count; i++)
+		if(calls[from * function_count + i] && (i == to || reaches(i, to, visited)))
+			return 1;
+	return 0;
+}
+
+int is_recursive(int function) {
+	char *visited = (char*)calloc(function_count, 1);
+	int recursive = reaches(function, function, visited);
+	free(visited);
+	return recursive;
+}
+
+// ----- INLINING -----
+
+// Is there anything in the body that stops it from being inlined?
+int blocks_inlining(struct syntax_node *node) {
+	for(; node; node = node->next) {
+		int category = node->token->token_category;
+		if(category == t_return || category == t_def)
+			return 1;
+		if(blocks_inlining(node->child))
+			return 1;
+	}
+	return 0;
+}
+
+// Does the callee use a global or a function by a name the caller has a local
+// or parameter called? Those names aren't renamed in the copy, so the caller's
+// local would be used instead
+int captures_names(struct function_info *caller, struct function_info *callee, struct syntax_node *node) {
+	for(; node; node = node->next) {
+		if(node->token->token_category == t_identifier
+			&& !is_local(callee, callee->body->child, node->token->symbol)
+			&& is_local(caller, caller->body->child, node->token->symbol))
+			return 1;
+		if(captures_names(caller, callee, node->child))
+			return 1;
+	}
+	return 0;
+}
+
+int can_inline(int caller, int callee, struct syntax_node *call) {
+	struct function_info *function = &function_table[callee];
+	int arguments = 0;
+	for(struct syntax_node *argument = call->child->child; argument; argument = argument->next)
+		arguments++;
+	return inline_max_nodes && callee != caller && arguments == function->parameters
+		&& count_tree(function->body->child) <= inline_max_nodes
+		&& !blocks_inlining(function->body->child) && !is_recursive(callee)
+		&& !captures_names(&function_table[caller], function, function->body->child);
+}
+
+// Is this symbol a parameter or local of the function?
+int is_local(struct function_info *function, struct syntax_node *node, struct symbol_data *symbol) {
+	for(struct syntax_node *parameter = function->parameter_list->child; parameter; parameter = parameter->next)
+		if(parameter->token->symbol == symbol)
+			return 1;
+	for(; node; node = node->next) {
+		int category = node->token->token_category;
+		if(category == t_var) {
+			for(struct syntax_node *name = node->child; name; name = name->next)
+				if(name->token->symbol == symbol)
+					return 1;
+		} else if((category == t_for || category == t_range_loop || category == t_each_loop)
+			&& node->child->token->symbol == symbol) {
+			return 1;
+		}
+		if(is_local(function, node->child, symbol))
+			return 1;
+	}
+	return 0;
+}
+
+// Gives an identifier token the renamed version of its symbol
+struct lexeme_token *renamed_token(struct function_info *function, struct lexeme_token *token) {
+	char name[200];
+	snprintf(name, sizeof(name), "%s.%s", function->name, token->symbol->lexeme);
+	return token_make(t_identifier, find_symbol(name, t_identifier, 1), token->offset);
+}
+
+// Rename the locals in a copied body
+void rename_locals(struct function_info *function, struct syntax_node *node) {
+	for(; node; node = node->next) {
+		if(node->token->token_category == t_identifier && is_local(function, function->body->child, node->token->symbol))
+			node->token = renamed_token(function, node->token);
+		rename_locals(function, node->child);
+	}
+}
+
+// Replace a call node with the callee's body
+void inline_call(int caller, int callee, struct syntax_node *call) {
+	struct function_info *function = &function_table[callee];
+	int offset = call->token->offset;
+
+	// var -> f.x -> argument, f.y -> argument
+	// held while it's built, and each argument is moved over as its name is made
+	struct syntax_node **link = &tree_hold()->child;
+	if(function->parameters) {
+		struct syntax_node *declaration = tree_make(token_make(t_var, NULL, offset));
+		*link = declaration;
+		link = &declaration->child;
+		for(struct syntax_node *parameter = function->parameter_list->child; parameter; parameter = parameter->next) {
+			struct syntax_node *name = tree_make(renamed_token(function, parameter->token));
+			struct syntax_node *argument = call->child->child;
+			call->child->child = argument->next;
+			argument->next = NULL;
+			name->child = argument;
+			*link = name;
+			link = &name->next;
+		}
+		link = &declaration->next;
+	}
+	call->child->child = NULL;
+
+	for(struct syntax_node *statement = function->body->child; statement; statement = statement->next) {
+		*link = tree_copy(statement);
+		rename_locals(function, *link);
+		link = &(*link)->next;
+	}
+
+	free_syntax_tree(call->child);
+	call->token = token_make(t_indent_in, NULL, offset);
+	call->child = tree_unhold();
+
+	if(inline_record_count == inline_record_capacity) {
+		inline_record_capacity = inline_record_capacity ? inline_record_capacity * 2 : 16;
+		inline_records = (struct inline_record*)realloc(inline_records, inline_record_capacity * sizeof(struct inline_record));
+		if(!inline_records)
+			error("Can't allocate inlining report");
+	}
+	inline_records[inline_record_count].callee = function->name;
+	inline_records[inline_record_count].caller = function_table[caller].name;
+	inline_records[inline_record_count].line = node_line(call);
+	inline_record_count++;
+	STATS_ADD(inlined_calls, 1);
+}
+
+// Look for call statements, which are the children of {{ blocks
+void inline_statements(int caller, struct syntax_node *node, int in_block) {
+	for(; node; node = node->next) {
+		if(node->token->token_category == t_def)
+			continue;
+		if(in_block && is_call(node)) {
+			int callee = named_function(node);
+			if(callee >= 0 && can_inline(caller, callee, node)) {
+				inline_call(caller, callee, node);
+				continue;
+			}
+		}
+		inline_statements(caller, node->child, node->token->token_category == t_indent_in);
+	}
+}
+
+// Inline into callees before callers, so what gets copied is already inlined
+void inline_function(int function, char *done) {
+	if(done[function])
+		return;
+	done[function] = 1;
+	for(int i=0; i<function_count; i++)
+		if(calls[function * function_count + i])
+			inline_function(i, done);
+	inline_statements(function, function_table[function].body, 1);
+}
+
+// ----- DEAD FUNCTIONS -----
+
+void mark_reachable(int function, char *reachable) {
+	if(reachable[function])
+		return;
+	reachable[function] = 1;
+	for(int i=0; i<function_count; i++)
+		if(calls[function * function_count + i])
+			mark_reachable(i, reachable);
+}
+
+// Remove top level defs nothing can get to
+void remove_dead_functions(struct syntax_node **tree) {
+	char *reachable = (char*)calloc(function_count + 1, 1);
+	char *global_uses = (char*)calloc(function_count + 1, 1);
+
+	find_calls(*tree, -1, global_uses);
+	for(int i=0; i<function_count; i++)
+		if(global_uses[i] || is_hook_name(function_table[i].name))
+			mark_reachable(i, reachable);
+
+	removed_function_count = 0;
+	free(removed_functions);
+	removed_functions = (const char**)calloc(function_count + 1, sizeof(const char*));
+
+	struct syntax_node **link = tree;
+	while(*link) {
+		struct syntax_node *node = *link;
+		int function = node->token->token_category == t_def ? named_function(node->child) : -1;
+		if(function >= 0 && !reachable[function]) {
+			removed_functions[removed_function_count++] = function_table[function].name;
+			STATS_ADD(removed_functions, 1);
+			*link = node->next;
+			node->next = NULL;
+			free_syntax_tree(node);
+			continue;
+		}
+		link = &node->next;
+	}
+
+	free(reachable);
+	free(global_uses);
+}
+
+// Inline small functions and remove unused ones, then rebuild the function table
+void inline_functions(struct syntax_node **tree) {
+	STATS_BEGIN(PHASE_INLINE);
+	inline_record_count = 0;
+
+	build_call_graph();
+	char *done = (char*)calloc(function_count + 1, 1);
+	for(int i=0; i<function_count; i++)
+		inline_function(i, done);
+	free(done);
+
+	// inlining may have left some functions with no callers
+	build_call_graph();
+	remove_dead_functions(tree);
+	STATS_END(PHASE_INLINE);
+
+	build_function_table(*tree);
+}
+
+// Print what was inlined and removed
+void print_inline_report(FILE *out) {
+	for(int i=0; i<inline_record_count; i++)
+		fprintf(out, "inlined %s into %s at line %d\n", inline_records[i].callee, inline_records[i].caller, inline_records[i].line);
+	for(int i=0; i<removed_function_count; i++)
+		fprintf(out, "removed %s, nothing calls it\n", removed_functions[i]);
+	if(!inline_record_count && !removed_function_count)
+		fprintf(out, "nothing inlined or removed\n");
+}
@@ -0,0 +1,293 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+#include <stdatomic.h>
+
+// ----- INTERN POOL -----
+// One copy of every identifier and literal for the whole process, shared by
+// every compilation, so a thousand scripts that all say "bomb" keep it once.
+// Each string gets an ID that compiled code can refer to it by.
+//
+// Lookups don't take any locks: a shard's table and the entries in it are
+// only ever published with a release store after they're completely
+// written, and nothing is freed until intern_pool_free(). Inserts take a
+// spinlock on one of INTERN_SHARDS shards, picked by hash, so threads
+// adding different strings rarely wait on each other. A table that gets too
+// full is copied into a bigger one; the old one is kept around, since a
+// reader may still be probing it.
+
+#define INTERN_SHARD_BITS  4
+#define INTERN_SHARDS      (1 << INTERN_SHARD_BITS)
+#define INTERN_START_SLOTS 256
+#define INTERN_BLOCK_SIZE  65536    // entries are packed into blocks this big
+#define INTERN_PAGE_BITS   12       // ID to string pages
+#define INTERN_PAGE_SIZE   (1 << INTERN_PAGE_BITS)
+#define INTERN_MAX_PAGES   4096
+
+struct intern_entry {
+	unsigned int hash;
+	int length;
+	int id;
+	char text[];
+};
+
+struct intern_table {
+	int slot_count;                            // power of two
+	int used;
+	struct intern_table *retired;              // older, smaller tables
+	_Atomic(struct intern_entry*) slots[];
+};
+
+struct intern_block {
+	struct intern_block *next;
+	int used;
+	char data[INTERN_BLOCK_SIZE];
+};
+
+struct intern_shard {
+	atomic_flag lock;
+	_Atomic(struct intern_table*) table;
+	struct intern_block *blocks;
+};
+
+struct intern_shard intern_shards[INTERN_SHARDS];
+typedef _Atomic(const char*) intern_page_entry;
+_Atomic(intern_page_entry*) intern_pages[INTERN_MAX_PAGES];
+atomic_int intern_next_id = 1;               // 0 is never a valid ID
+atomic_long intern_total_strings, intern_total_bytes, intern_total_saved;
+
+int use_intern_pool = 1;
+
+unsigned int intern_hash(const char *text, int length) {
+	unsigned int hash = 2166136261u;
+	for(int i=0; i<length; i++)
+		hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+	return hash;
+}
+
+// These run with a shard locked, so instead of calling error() they return
+// NULL and say why in *problem, and the caller unlocks before reporting it.
+// Otherwise the next string to go in that shard would wait on it forever,
+// since error() doesn't come back in watch mode.
+
+struct intern_table *intern_table_new(int slot_count, const char **problem) {
+	struct intern_table *table = (struct intern_table*)calloc(1, sizeof(struct intern_table) + slot_count * sizeof(struct intern_entry*));
+	if(!table) {
+		*problem = "Can't allocate intern table";
+		return NULL;
+	}
+	table->slot_count = slot_count;
+	for(int i=0; i<slot_count; i++)
+		atomic_init(&table->slots[i], NULL);
+	return table;
+}
+
+// Probe a table for a string; no lock needed
+struct intern_entry *intern_probe(struct intern_table *table, const char *text, int length, unsigned int hash) {
+	if(!table)
+		return NULL;
+	int mask = table->slot_count - 1;
+	for(int slot = hash & mask; ; slot = (slot+1) & mask) {
+		struct intern_entry *entry = atomic_load_explicit(&table->slots[slot], memory_order_acquire);
+		if(!entry)
+			return NULL;
+		if(entry->hash == hash && entry->length == length && !memcmp(entry->text, text, length))
+			return entry;
+	}
+}
+
+// Put an entry into a table that's known to have room, with the shard locked
+void intern_place(struct intern_table *table, struct intern_entry *entry) {
+	int mask = table->slot_count - 1;
+	int slot = entry->hash & mask;
+	while(atomic_load_explicit(&table->slots[slot], memory_order_relaxed))
+		slot = (slot+1) & mask;
+	atomic_store_explicit(&table->slots[slot], entry, memory_order_release);
+	table->used++;
+}
+
+// Get a table that has room for one more entry, growing the shard's if it
+// needs it, with the shard locked
+struct intern_table *intern_make_room(struct intern_shard *shard, struct intern_table *table, const char **problem) {
+	// keep tables at most half full so probes stay short
+	if(table && (table->used + 1) * 2 <= table->slot_count)
+		return table;
+	struct intern_table *bigger = intern_table_new(table ? table->slot_count * 2 : INTERN_START_SLOTS, problem);
+	if(!bigger)
+		return NULL;
+	if(table) {
+		for(int i=0; i<table->slot_count; i++) {
+			struct intern_entry *old = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+			if(old)
+				intern_place(bigger, old);
+		}
+	}
+	bigger->retired = table;
+	atomic_store_explicit(&shard->table, bigger, memory_order_release);
+	return bigger;
+}
+
+// Copy an entry's bytes into the shard's current block
+struct intern_entry *intern_entry_new(struct intern_shard *shard, const char *text, int length, unsigned int hash, const char **problem) {
+	size_t size = (sizeof(struct intern_entry) + length + 1 + 7) & ~(size_t)7;
+	struct intern_entry *entry;
+	if(size > INTERN_BLOCK_SIZE / 4) {
+		// big ones get their own allocation, so they don't waste most of a block
+		struct intern_block *block = (struct intern_block*)malloc(sizeof(struct intern_block) - INTERN_BLOCK_SIZE + size);
+		if(!block) {
+			*problem = "Can't allocate intern block";
+			return NULL;
+		}
+		// it's full, so small entries never go in it, and it goes after the
+		// block they're going in so that one stays the current block
+		block->used = INTERN_BLOCK_SIZE;
+		block->next = shard->blocks ? shard->blocks->next : NULL;
+		if(shard->blocks)
+			shard->blocks->next = block;
+		else
+			shard->blocks = block;
+		entry = (struct intern_entry*)block->data;
+	} else {
+		if(!shard->blocks || shard->blocks->used + size > INTERN_BLOCK_SIZE) {
+			struct intern_block *block = (struct intern_block*)malloc(sizeof(struct intern_block));
+			if(!block) {
+				*problem = "Can't allocate intern block";
+				return NULL;
+			}
+			block->used = 0;
+			block->next = shard->blocks;
+			shard->blocks = block;
+		}
+		entry = (struct intern_entry*)(shard->blocks->data + shard->blocks->used);
+		shard->blocks->used += (int)size;
+	}
+	entry->hash = hash;
+	entry->length = length;
+	memcpy(entry->text, text, length);
+	entry->text[length] = 0;
+
+	// give it an ID, making the page for it if nobody has yet
+	entry->id = atomic_fetch_add(&intern_next_id, 1);
+	int page_number = entry->id >> INTERN_PAGE_BITS;
+	if(page_number >= INTERN_MAX_PAGES) {
+		*problem = "Too many interned strings";
+		return NULL;
+	}
+	intern_page_entry *page = atomic_load_explicit(&intern_pages[page_number], memory_order_acquire);
+	if(!page) {
+		intern_page_entry *new_page = (intern_page_entry*)calloc(INTERN_PAGE_SIZE, sizeof(intern_page_entry));
+		if(!new_page) {
+			*problem = "Can't allocate intern page";
+			return NULL;
+		}
+		if(atomic_compare_exchange_strong(&intern_pages[page_number], &page, new_page))
+			page = new_page;
+		else
+			free(new_page);
+	}
+	atomic_store_explicit(&page[entry->id & (INTERN_PAGE_SIZE-1)], entry->text, memory_order_release);
+
+	atomic_fetch_add(&intern_total_strings, 1);
+	atomic_fetch_add(&intern_total_bytes, length + 1);
+	return entry;
+}
+
+// Get the pool's copy of a string, adding it if it isn't there yet.
+// Safe to call from any number of threads at once. The ID goes in *id, and
+// *added is set to 1 if this call is what added it; either can be NULL
+const char *intern_string(const char *text, int *id, int *added) {
+	int length = (int)strlen(text);
+	unsigned int hash = intern_hash(text, length);
+	struct intern_shard *shard = &intern_shards[hash >> (32 - INTERN_SHARD_BITS)];
+	int was_added = 0;
+	const char *problem = NULL;
+
+	struct intern_entry *entry = intern_probe(atomic_load_explicit(&shard->table, memory_order_acquire), text, length, hash);
+	if(!entry) {
+		while(atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire))
+			;
+		// someone may have added it while we were waiting
+		struct intern_table *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+		entry = intern_probe(table, text, length, hash);
+		if(!entry) {
+			table = intern_make_room(shard, table, &problem);
+			if(table)
+				entry = intern_entry_new(shard, text, length, hash, &problem);
+			if(entry) {
+				intern_place(table, entry);
+				was_added = 1;
+			}
+		} else {
+			atomic_fetch_add(&intern_total_saved, length + 1);
+		}
+		atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+		if(problem)
+			error("%s", problem);
+	} else {
+		atomic_fetch_add_explicit(&intern_total_saved, length + 1, memory_order_relaxed);
+	}
+
+	if(id)
+		*id = entry->id;
+	if(added)
+		*added = was_added;
+	return entry->text;
+}
+
+// Get a string back from its ID, or NULL if there's no such ID
+const char *intern_text(int id) {
+	if(id <= 0 || id >= atomic_load(&intern_next_id))
+		return NULL;
+	intern_page_entry *page = atomic_load_explicit(&intern_pages[id >> INTERN_PAGE_BITS], memory_order_acquire);
+	return page ? atomic_load_explicit(&page[id & (INTERN_PAGE_SIZE-1)], memory_order_acquire) : NULL;
+}
+
+// Totals for the whole process, across every compilation so far
+void intern_pool_stats(long *strings, long *bytes, long *saved) {
+	*strings = atomic_load(&intern_total_strings);
+	*bytes = atomic_load(&intern_total_bytes);
+	*saved = atomic_load(&intern_total_saved);
+}
+
+// Free the whole pool. Nothing else can be using it at the time
+void intern_pool_free() {
+	for(int i=0; i<INTERN_SHARDS; i++) {
+		struct intern_shard *shard = &intern_shards[i];
+		struct intern_table *table = atomic_load(&shard->table);
+		while(table) {
+			struct intern_table *retired = table->retired;
+			free(table);
+			table = retired;
+		}
+		atomic_store(&shard->table, NULL);
+		while(shard->blocks) {
+			struct intern_block *next = shard->blocks->next;
+			free(shard->blocks);
+			shard->blocks = next;
+		}
+	}
+	for(int i=0; i<INTERN_MAX_PAGES; i++) {
+		free((void*)atomic_load(&intern_pages[i]));
+		atomic_store(&intern_pages[i], NULL);
+	}
+	atomic_store(&intern_next_id, 1);
+	atomic_store(&intern_total_strings, 0);
+	atomic_store(&intern_total_bytes, 0);
+	atomic_store(&intern_total_saved, 0);
+}
@@ -98,6 +98,8 @@ const char *token_strings[t_max_tokens][20] = {
 	{"\n", "\n", NULL},
 	{"{{", "{{", NULL},
 	{"]}", "}}", NULL},
+	{"range loop", "range loop", NULL},
+	{"each loop", "each loop", NULL},
 };
 
 // Makes a string representation of a token
@@ -121,6 +123,15 @@ const char *token_print(struct lexeme_token *token) {
 	return buffer;
 }
 
+// Makes a string representation of a position in the source
+const char *offset_print(int offset) {
+	static char buffer[40];
+	int line, column;
+	source_position(offset, &line, &column);
+	sprintf(buffer, "line %d, column %d", line, column);
+	return buffer;
+}
+
 // ----- STATE VARIABLES -----
 
 char lexeme[100] = ""; // buffer to accumulate the lexeme in
@@ -129,16 +140,106 @@ struct lexeme_token *token_list = NULL;
 struct lexeme_token *token_current = NULL;
 FILE *program_file;
 int c; // current character
+int c_offset;        // byte offset of the current character
+int read_offset;     // byte offset of the next character to read
+int lexeme_offset;   // byte offset where the current lexeme started
+
+// ----- SOURCE POSITIONS -----
+// Tokens only store a byte offset. Lines are found by binary searching
+// the offset of the start of each line, which is recorded while reading.
+
+int *line_starts = NULL;
+int line_count = 0;
+int line_capacity = 0;
+
+// Note that a new line starts at the given offset
+void add_line_start(int offset) {
+	if(line_count == line_capacity) {
+		line_capacity = line_capacity ? line_capacity * 2 : 256;
+		line_starts = (int*)realloc(line_starts, line_capacity * sizeof(int));
+		if(!line_starts)
+			error("Can't allocate line table");
+		STATS_ALLOC(line_capacity * sizeof(int));
+	}
+	line_starts[line_count++] = offset;
+}
+
+// Finds the 1-based line and column of a byte offset in the last file lexed
+void source_position(int offset, int *line, int *column) {
+	int low = 0, high = line_count - 1;
+	// find the last line that starts at or before the offset
+	while(low < high) {
+		int middle = (low + high + 1) / 2;
+		if(line_starts[middle] <= offset)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	*line = low + 1;
+	*column = offset - (line_count ? line_starts[low] : 0) + 1;
+}
+
+// Writes an unsigned number using 7 bits per byte, high bit set if more bytes follow
+int write_varint(unsigned char *out, unsigned int value) {
+	int length = 0;
+	while(value >= 0x80) {
+		out[length++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	out[length++] = value;
+	return length;
+}
+
+// Makes the delta encoded line table: the number of lines followed by the
+// length in bytes of each line, as varints. out can be NULL to just get the size.
+int line_table_encode(unsigned char *out) {
+	unsigned char scratch[5];
+	int size = write_varint(out ? out : scratch, line_count);
+	for(int i=1; i<line_count; i++)
+		size += write_varint(out ? out + size : scratch, line_starts[i] - line_starts[i-1]);
+	return size;
+}
+
+// Reads a number written by write_varint, moving the pointer past it
+unsigned int read_varint(const unsigned char **in) {
+	unsigned int value = 0;
+	int shift = 0;
+	do {
+		value |= (**in & 0x7f) << shift;
+		shift += 7;
+	} while(*((*in)++) & 0x80);
+	return value;
+}
+
+// Turns a line table back into line start offsets, returns the number of lines
+int line_table_decode(const unsigned char *in, int **starts) {
+	int count = read_varint(&in);
+	*starts = (int*)calloc(count ? count : 1, sizeof(int));
+	for(int line = 1; line < count; line++)
+		(*starts)[line] = (*starts)[line-1] + read_varint(&in);
+	return count;
+}
 
 // ----- SYMBOL TABLE -----
 
 // Allocate a new symbol for the symbol table
 struct symbol_data *alloc_symbol(const char *lexeme, int token_category) {
-	struct symbol_data *new_symbol;
+	struct symbol_data *new_symbol = (struct symbol_data*)calloc(1, sizeof(struct symbol_data));
 	if(new_symbol == NULL)
 		error("Couldn't allocate symbol");
-	new_symbol = (struct symbol_data*)calloc(1, sizeof(struct symbol_data));
-	new_symbol->lexeme = strdup(lexeme);
+	STATS_ADD(symbols, 1);
+	STATS_ALLOC(sizeof(struct symbol_data));
+	if(use_intern_pool) {
+		int added;
+		new_symbol->lexeme = intern_string(lexeme, &new_symbol->intern_id, &added);
+		if(added)
+			STATS_ALLOC(strlen(lexeme) + 1);
+		else
+			STATS_ADD(intern_saved_bytes, strlen(lexeme) + 1);
+	} else {
+		new_symbol->lexeme = strdup(lexeme);
+		STATS_ALLOC(strlen(lexeme) + 1);
+	}
 	new_symbol->token_category = token_category;
 	new_symbol->next = NULL;
 	return new_symbol;
@@ -148,6 +249,7 @@ struct symbol_data *alloc_symbol(const char *lexeme, int token_category) {
 struct symbol_data *find_symbol(const char *lexeme, int token_category, int auto_create) {
 	struct symbol_data *symbol;
 	struct symbol_data *new_symbol;
+	STATS_ADD(symbol_lookups, 1);
 
 	// If the symbol table is empty, handle that
 	if(!symbol_table) {
@@ -161,11 +263,21 @@ struct symbol_data *find_symbol(const char *lexeme, int token_category, int auto
 
 	// Find the symbol if it exists
 	struct symbol_data *previous = NULL;
+#ifdef TTC_STATS
+	long probes = 0;
+#endif
 	for(symbol = symbol_table; symbol; symbol = symbol->next) {
 		previous = symbol;
+#ifdef TTC_STATS
+		probes++;
+#endif
 		if(!strcmp(symbol->lexeme, lexeme) && symbol->token_category == token_category)
-			return symbol;
+			break;
 	}
+	STATS_ADD(symbol_probes, probes);
+	STATS_MAX(symbol_probe_max, probes);
+	if(symbol)
+		return symbol;
 
 	// Symbol does not exist, can I create it?
 	if(!auto_create)
@@ -176,11 +288,25 @@ struct symbol_data *find_symbol(const char *lexeme, int token_category, int auto
 	return new_symbol;
 }
 
+// Free every symbol, so the lexer can be run again from scratch
+void free_symbol_table() {
+	while(symbol_table) {
+		struct symbol_data *next = symbol_table->next;
+		if(!symbol_table->intern_id)
+			free((void*)symbol_table->lexeme);
+		free(symbol_table);
+		symbol_table = next;
+	}
+}
+
 // ----- LEXICAL ANALYZER -----
 
 // Reads the next character from the file
 void get_char() {
 	c = fgetc(program_file);
+	c_offset = read_offset++;
+	if(c == '\n')
+		add_line_start(read_offset);
 }
 
 // Adds a character, and ends the string there
@@ -217,6 +343,8 @@ void add_token(int token_category, int symbol) {
 	if(!token) {
 		error("Can't allocate token");
 	}
+	STATS_ADD(tokens, 1);
+	STATS_ALLOC(sizeof(struct lexeme_token));
 
 	if(symbol) {
 	// If it's a symbol, maintain the symbol table
@@ -230,6 +358,7 @@ void add_token(int token_category, int symbol) {
 			}
 	}
 	token->token_category = token_category;
+	token->offset = lexeme_offset;
 	token->next = NULL;
 
 	// Add it to the list
@@ -247,6 +376,15 @@ void add_token(int token_category, int symbol) {
 	clear_lexeme();
 }
 
+// Free a token list made by lexical_analyzer
+void free_token_list(struct lexeme_token *list) {
+	while(list) {
+		struct lexeme_token *next = list->next;
+		free(list);
+		list = next;
+	}
+}
+
 // Adds a token consisting of one character
 void add_char_token(int token_category) {
 	add_char();
@@ -255,9 +393,14 @@ void add_char_token(int token_category) {
 
 // Run the lexical analyzer
 struct lexeme_token *lexical_analyzer(FILE *File) {
+	STATS_BEGIN(PHASE_LEX);
 	program_file = File;
 	token_list = NULL;
 	token_current = NULL;
+	c = 0;
+	read_offset = 0;
+	line_count = 0;
+	add_line_start(0);
 	clear_lexeme();
 
 	// Lexical analyzer main loop
@@ -269,6 +412,7 @@ struct lexeme_token *lexical_analyzer(FILE *File) {
 		if(c == EOF) {	 // Stop if the end was reached
 			break;
 		}
+		lexeme_offset = c_offset;
 
 		// Recognize all the different types of tokens
 		if(isspace(c)) { // Ignore space characters
@@ -377,7 +521,7 @@ struct lexeme_token *lexical_analyzer(FILE *File) {
 			}
 			int is_a_float = is_float(lexeme);
 			if(is_a_float == 0)
-				error("Invalid number %s", lexeme);
+				error("Invalid number %s at %s", lexeme, offset_print(lexeme_offset));
 			if(is_a_float == 1) // 1 = float
 				add_token(t_real, 1);
 			if(is_a_float == 2) // 2 = integer
@@ -388,9 +532,10 @@ struct lexeme_token *lexical_analyzer(FILE *File) {
 				get_char();
 			} while(c != '\n' && c != EOF);
 		} else {
-			error("Unexpected character %c", c);
+			error("Unexpected character %c at %s", c, offset_print(c_offset));
 		}
 
 	}
+	STATS_END(PHASE_LEX);
 	return token_list;
 }
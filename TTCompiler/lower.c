@@ -0,0 +1,233 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- LOOP LOWERING -----
+// The parser leaves "for n = a to b step c" as
+//   for -> n, = -> (a, to, b, step -> c), body
+// This turns it into
+//   range loop -> n, a, b, c, body
+// where a, b and c are evaluated once on entry and the back end emits the
+// loop as one increment-compare-branch. This runs before type inference, so
+// n is only known to be a number here; infer_types() proves it's an integer
+// when a, b and c all are, and the back end gives it an integer slot then.
+// Loops with small integer constant bounds are unrolled instead.
+// "for n in list" becomes
+//   each loop -> n, list, body
+// which the back end emits with one fused iterator instruction.
+
+#define UNROLL_MAX_TRIPS 8    // most iterations to unroll
+#define UNROLL_MAX_NODES 256  // most nodes the unrolled copies can add up to
+
+// Count the nodes in a list and their children
+int count_tree(struct syntax_node *node) {
+	int count = 0;
+	for(; node; node = node->next)
+		count += 1 + count_tree(node->child);
+	return count;
+}
+
+// Does anything in the tree assign to or redeclare this symbol?
+int changes_counter(struct syntax_node *node, struct symbol_data *counter) {
+	for(; node; node = node->next) {
+		int category = node->token->token_category;
+		// assignment is = -> target, value
+		if(category == t_assignment && node->child && node->child->token->symbol == counter)
+			return 1;
+		// var -> name -> value
+		if(category == t_var)
+			for(struct syntax_node *name = node->child; name; name = name->next)
+				if(name->token->symbol == counter)
+					return 1;
+		// inner loops and nested functions could use the same name
+		if((category == t_for || category == t_range_loop || category == t_each_loop || category == t_def)
+			&& node->child && node->child->token->symbol == counter)
+			return 1;
+		if(changes_counter(node->child, counter))
+			return 1;
+	}
+	return 0;
+}
+
+// Is there a break or continue for this loop? Ones inside inner loops are for those
+int exits_loop(struct syntax_node *node) {
+	for(; node; node = node->next) {
+		int category = node->token->token_category;
+		if(category == t_break || category == t_continue)
+			return 1;
+		if(category == t_while || category == t_until || category == t_for || category == t_range_loop
+			|| category == t_each_loop || category == t_def)
+			continue;
+		if(exits_loop(node->child))
+			return 1;
+	}
+	return 0;
+}
+
+// Gets the value of an integer expression made only of constants. Returns 1 if it is one
+int constant_integer(struct syntax_node *node, long *value) {
+	if(!node)
+		return 0;
+	struct lexeme_token *token = node->token;
+	long left, right;
+
+	switch(token->token_category) {
+		case t_integer:
+			*value = strtol(token->symbol->lexeme, NULL, 10);
+			return 1;
+		case t_addsub:
+			if(!constant_integer(node->child, &left))
+				return 0;
+			if(!node->child->next) { // sign
+				*value = token->token_value == 2 ? -left : left;
+				return 1;
+			}
+			if(!constant_integer(node->child->next, &right))
+				return 0;
+			*value = token->token_value == 2 ? left - right : left + right;
+			return 1;
+		case t_muldiv:
+			if(!constant_integer(node->child, &left) || !constant_integer(node->child->next, &right))
+				return 0;
+			if(token->token_value == 1)
+				*value = left * right;
+			else if(!right)
+				return 0; // leave division by zero for the runtime to complain about
+			else
+				*value = token->token_value == 2 ? left / right : left % right;
+			return 1;
+	}
+	return 0;
+}
+
+// Makes an integer literal node
+struct syntax_node *make_integer(long value, int offset) {
+	char text[24];
+	sprintf(text, "%ld", value);
+	return tree_make(token_make(t_integer, find_symbol(text, t_integer, 1), offset));
+}
+
+// Replace a range loop with a block that sets the counter and runs the body for each value
+void unroll(struct syntax_node *loop, struct syntax_node *counter, long start, long step, long trips, struct syntax_node *body) {
+	int offset = loop->token->offset;
+	struct syntax_node **link = &tree_hold()->child;
+
+	for(long i=0; i<trips; i++) {
+		// = -> counter, value
+		struct syntax_node *assignment = tree_make(token_make(t_assignment, NULL, offset));
+		assignment->token->token_value = 1;
+		assignment->child = tree_make(counter->token);
+		assignment->child->next = make_integer(start + i * step, offset);
+		*link = assignment;
+		assignment->next = tree_copy(body);
+		link = &assignment->next->next;
+	}
+
+	free_syntax_tree(loop->child);
+	loop->token = token_make(t_indent_in, NULL, offset);
+	loop->child = tree_unhold();
+	STATS_ADD(unrolled_loops, 1);
+}
+
+// Turn one for loop into a range loop or an each loop
+void lower_for(struct syntax_node *loop) {
+	struct syntax_node *counter = loop->child;
+	struct syntax_node *header = counter->next;
+	struct syntax_node *body = header->next;
+
+	if(header->token->token_category == t_in) {
+		// for -> n, in -> list, body  becomes  each loop -> n, list, body
+		struct syntax_node *list = header->child;
+		counter->next = list;
+		list->next = body;
+		header->child = NULL;
+		header->next = NULL;
+		free_syntax_tree(header);
+		loop->token = token_make(t_each_loop, NULL, loop->token->offset);
+		STATS_ADD(each_loops, 1);
+		return;
+	}
+
+	// the bounds are only evaluated once, so a counter the body changes has to stay generic
+	if(changes_counter(body, counter->token->symbol))
+		return;
+
+	// = -> start, to, end, step -> amount
+	struct syntax_node *start = header->child;
+	struct syntax_node *to = start->next;
+	struct syntax_node *end = to->next;
+	struct syntax_node *step = end->next;
+	struct syntax_node *amount = step ? step->child : NULL;
+
+	long start_value, end_value, step_value = 1;
+	int constant = constant_integer(start, &start_value) && constant_integer(end, &end_value)
+		&& (!amount || constant_integer(amount, &step_value));
+	// unrolled copies have no loop left to break out of
+	if(constant && step_value && !exits_loop(body)) {
+		long trips = 0;
+		if(step_value > 0 && end_value >= start_value)
+			trips = (end_value - start_value) / step_value + 1;
+		if(step_value < 0 && end_value <= start_value)
+			trips = (start_value - end_value) / -step_value + 1;
+		if(trips <= UNROLL_MAX_TRIPS && trips * count_tree(body) <= UNROLL_MAX_NODES) {
+			// the counter node gets freed along with the loop, so the copies use its token
+			unroll(loop, counter, start_value, step_value, trips, body);
+			return;
+		}
+	}
+
+	// range loop -> n, start, end, step, body
+	if(amount) {
+		step->child = NULL;
+	} else {
+		amount = make_integer(1, loop->token->offset);
+	}
+	counter->next = start;
+	start->next = end;
+	end->next = amount;
+	amount->next = body;
+
+	header->child = NULL;
+	header->next = NULL;
+	to->next = NULL;
+	free_syntax_tree(header);
+	free_syntax_tree(to);
+	if(step) {
+		step->next = NULL;
+		free_syntax_tree(step);
+	}
+	loop->token = token_make(t_range_loop, NULL, loop->token->offset);
+	STATS_ADD(range_loops, 1);
+}
+
+void lower_node(struct syntax_node *node) {
+	for(; node; node = node->next) {
+		// lower inner loops first so the outer loop's body is final before it's copied
+		lower_node(node->child);
+		if(node->token->token_category == t_for)
+			lower_for(node);
+	}
+}
+
+// Lower every for loop in the syntax tree
+void lower_loops(struct syntax_node *tree) {
+	STATS_BEGIN(PHASE_LOWER);
+	lower_node(tree);
+	STATS_END(PHASE_LOWER);
+}
@@ -1 +1,3 @@
-gcc ttc.c lexer.c syntax.c -o ttc -g
\ No newline at end of file
+gcc ttc.c lexer.c syntax.c lower.c functions.c inline.c exports.c builtins.c types.c escape.c intern.c watch.c stats.c -o ttc -g -DTTC_STATS
+gcc bench.c lexer.c syntax.c intern.c stats.c -o ttcbench -O2 -pthread
+gcc bench.c lexer.c syntax.c intern.c stats.c -o ttcbench_tsan -O1 -g -fsanitize=thread -pthread
\ No newline at end of file
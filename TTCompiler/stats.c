@@ -0,0 +1,86 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Statistics for the compilation in progress; only filled in when built with TTC_STATS
+struct compile_stats compile_stats;
+
+const char *stats_phase_names[PHASE_COUNT] = {
+	"lex", "indent", "parse", "lower", "functions", "inline", "exports", "types", "escape",
+};
+
+// Nanoseconds from some fixed point in the past
+double stats_now() {
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1e9 / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+#endif
+}
+
+// Start counting for a new compilation
+void stats_reset() {
+	memset(&compile_stats, 0, sizeof(compile_stats));
+}
+
+// Print statistics in a "name value" format that's easy to read and to parse
+void stats_print(FILE *out, struct compile_stats *stats) {
+	double total = 0;
+	for(int i=0; i<PHASE_COUNT; i++) {
+		fprintf(out, "time.%s_us %.1f\n", stats_phase_names[i], stats->phase_ns[i] / 1000);
+		total += stats->phase_ns[i];
+	}
+	fprintf(out, "time.total_us %.1f\n", total / 1000);
+	fprintf(out, "count.tokens %ld\n", stats->tokens);
+	fprintf(out, "count.symbols %ld\n", stats->symbols);
+	fprintf(out, "count.nodes %ld\n", stats->nodes);
+	fprintf(out, "symbol.lookups %ld\n", stats->symbol_lookups);
+	fprintf(out, "symbol.probes %ld\n", stats->symbol_probes);
+	fprintf(out, "symbol.probe_max %ld\n", stats->symbol_probe_max);
+	fprintf(out, "symbol.probe_average %.2f\n", stats->symbol_lookups ? (double)stats->symbol_probes / stats->symbol_lookups : 0.0);
+	fprintf(out, "alloc.bytes %ld\n", stats->alloc_bytes);
+	fprintf(out, "alloc.count %ld\n", stats->alloc_count);
+	fprintf(out, "depth.statement_max %d\n", stats->statement_depth_max);
+	fprintf(out, "depth.expression_max %d\n", stats->expression_depth_max);
+	fprintf(out, "lower.range_loops %ld\n", stats->range_loops);
+	fprintf(out, "lower.unrolled_loops %ld\n", stats->unrolled_loops);
+	fprintf(out, "lower.each_loops %ld\n", stats->each_loops);
+	fprintf(out, "inline.calls %ld\n", stats->inlined_calls);
+	fprintf(out, "inline.removed_functions %ld\n", stats->removed_functions);
+	fprintf(out, "host.deferred_calls %ld\n", stats->deferred_calls);
+	fprintf(out, "host.flush_calls %ld\n", stats->flush_calls);
+	fprintf(out, "escape.region_sites %ld\n", stats->region_sites);
+	fprintf(out, "escape.heap_sites %ld\n", stats->heap_sites);
+	fprintf(out, "intern.saved_bytes %ld\n", stats->intern_saved_bytes);
+	long strings, bytes, saved;
+	intern_pool_stats(&strings, &bytes, &saved);
+	fprintf(out, "intern.pool_strings %ld\n", strings);
+	fprintf(out, "intern.pool_bytes %ld\n", bytes);
+	fprintf(out, "intern.pool_saved_bytes %ld\n", saved);
+}
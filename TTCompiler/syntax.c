@@ -26,6 +26,8 @@ struct syntax_node *tree_current = NULL;
 // Make a new tree node
 struct syntax_node *tree_new() {
   struct syntax_node *node = (struct syntax_node*)calloc(1, sizeof(struct syntax_node));
+  STATS_ADD(nodes, 1);
+  STATS_ALLOC(sizeof(struct syntax_node));
   node->token = token_current;
   return node;
 }
@@ -69,8 +71,99 @@ void tree_child() {
   tree_current = node;
 }
 
+// Make a new tree node for a given token, for passes after parsing
+struct syntax_node *tree_make(struct lexeme_token *token) {
+  struct syntax_node *node = (struct syntax_node*)calloc(1, sizeof(struct syntax_node));
+  if(!node)
+    error("Can't allocate tree node");
+  STATS_ADD(nodes, 1);
+  STATS_ALLOC(sizeof(struct syntax_node));
+  node->token = token;
+  return node;
+}
+
+// Copy a node and its children, but not its siblings
+struct syntax_node *tree_copy(struct syntax_node *node) {
+  struct syntax_node *copy = tree_make(node->token);
+  struct syntax_node **link = &copy->child;
+  for(struct syntax_node *child = node->child; child; child = child->next) {
+    *link = tree_copy(child);
+    link = &(*link)->next;
+  }
+  return copy;
+}
+
+// Tokens made by passes after the lexer, kept here so they can be freed
+struct lexeme_token *made_tokens = NULL;
+
+struct lexeme_token *token_make(int token_category, struct symbol_data *symbol, int offset) {
+  struct lexeme_token *token = (struct lexeme_token*)calloc(1, sizeof(struct lexeme_token));
+  if(!token)
+    error("Can't allocate token");
+  STATS_ADD(tokens, 1);
+  STATS_ALLOC(sizeof(struct lexeme_token));
+  token->token_category = token_category;
+  token->symbol = symbol;
+  token->offset = offset;
+  token->next = made_tokens;
+  made_tokens = token;
+  return token;
+}
+
+void free_made_tokens() {
+  free_token_list(made_tokens);
+  made_tokens = NULL;
+}
+
+// Free a node, its children and all of the siblings after it
+void free_syntax_tree(struct syntax_node *node) {
+  while(node) {
+    struct syntax_node *next = node->next;
+    free_syntax_tree(node->child);
+    free(node);
+    node = next;
+  }
+}
+
+// Nodes that are being built but aren't in the tree yet, like the left side
+// of an operator before the operator is found, go under a held node, so that
+// if there's an error partway through they can still be freed. Held nodes
+// are a stack, and are kept around to be reused.
+struct syntax_node **tree_held = NULL;
+int tree_held_count = 0, tree_held_capacity = 0;
+
+struct syntax_node *tree_hold() {
+	if(tree_held_count == tree_held_capacity) {
+		int capacity = tree_held_capacity ? tree_held_capacity * 2 : 64;
+		tree_held = (struct syntax_node**)realloc(tree_held, capacity * sizeof(struct syntax_node*));
+		if(!tree_held)
+			error("Can't allocate held nodes");
+		for(; tree_held_capacity < capacity; tree_held_capacity++)
+			if(!(tree_held[tree_held_capacity] = (struct syntax_node*)malloc(sizeof(struct syntax_node))))
+				error("Can't allocate held nodes");
+	}
+	struct syntax_node *held = tree_held[tree_held_count++];
+	memset(held, 0, sizeof(struct syntax_node));
+	return held;
+}
+
+// Stop holding the newest held node, and get what was built under it
+struct syntax_node *tree_unhold() {
+	struct syntax_node *held = tree_held[--tree_held_count];
+	struct syntax_node *child = held->child;
+	held->child = NULL;
+	return child;
+}
+
+// Free whatever an error left held
+void free_held_trees() {
+	while(tree_held_count)
+		free_syntax_tree(tree_unhold());
+}
+
 // ----- CONVERT INDENTS TO BRACES -----
 void convert_indents(struct lexeme_token *list) {
+	STATS_BEGIN(PHASE_INDENT);
 	int indent_level[20] = {0};
 	int indent_index = 0;
 
@@ -83,6 +176,7 @@ void convert_indents(struct lexeme_token *list) {
 				
 				memcpy(list, free_me, sizeof(struct lexeme_token));
 				free(free_me);
+				STATS_ADD(tokens, -1);
 				list->next = after;
 			}
 
@@ -92,12 +186,15 @@ void convert_indents(struct lexeme_token *list) {
 			if(target > indent_level[indent_index]) {
 				// indenting in
 				if(indent_index == 19) // stack overflow
-					error("Too many indents");
+					error("Too many indents at %s", offset_print(list->offset));
 				indent_level[++indent_index] = target;
 
 				// add a t_indent_in token
 				struct lexeme_token *new_token = (struct lexeme_token*)calloc(1, sizeof(struct lexeme_token));
+				STATS_ADD(tokens, 1);
+				STATS_ALLOC(sizeof(struct lexeme_token));
 				new_token->token_category = t_indent_in;
+				new_token->offset = list->next ? list->next->offset : list->offset;
 				new_token->next = list->next;
 				list->next = new_token;
 				list = new_token;
@@ -110,17 +207,21 @@ void convert_indents(struct lexeme_token *list) {
 
 					// add a t_indent_out token
 					struct lexeme_token *new_token = (struct lexeme_token*)calloc(1, sizeof(struct lexeme_token));
+					STATS_ADD(tokens, 1);
+					STATS_ALLOC(sizeof(struct lexeme_token));
 					new_token->token_category = t_indent_out;
+					new_token->offset = list->next ? list->next->offset : list->offset;
 					new_token->next = list->next;
 					list->next = new_token;
 					list = new_token;
 				}
 				if(indent_level[indent_index] != target)
-					error("Inconsistent indentation?");
+					error("Inconsistent indentation at %s", offset_print(list->offset));
 			}
 		}
 		list = list->next;
 	}
+	STATS_END(PHASE_INDENT);
 }
 
 // ----- SYNTACTICAL ANALYZER -----
@@ -145,6 +246,8 @@ enum {
 int accept(int flags, ...) {
 	int passing = 0;
 	va_list argptr;
+	if(!token_current)
+		error("Unexpected end of file");
 	va_start(argptr, flags);
 
 	// Loop through the list of acceptable token types
@@ -162,7 +265,7 @@ int accept(int flags, ...) {
 		return passing;
 	// If it's needed, it's an error if it's not found
 	if(!passing && (flags & NEEDED))
-		error("Unexpected token, %s", token_strings[token_current->token_category][0]);
+		error("Unexpected token, %s at %s", token_strings[token_current->token_category][0], offset_print(token_current->offset));
 	// If it's passing, accept it and get the next token
 	if(passing) {
 		if(!(flags & OMIT))
@@ -220,18 +323,17 @@ void factor() {
 void term() {
 	struct syntax_node *save = tree_current;
 
-	// make a temporary node to attach the left hand side onto
-	struct syntax_node temp = {NULL, NULL, NULL};
-	tree_current = &temp;
+	// hold a node to attach the left hand side onto
+	tree_current = tree_hold();
 	factor();
 	tree_current = save;
 
 	struct syntax_node *operator = NULL;
 	if(accept(0, t_muldiv, -1)) {
-		tree_add_child(tree_current, temp.child);
+		tree_add_child(tree_current, tree_unhold());
 		term();
 	} else {
-		tree_add_child(save, temp.child);
+		tree_add_child(save, tree_unhold());
 	}
 	tree_current = save;
 }
@@ -239,20 +341,19 @@ void term() {
 // The most outer level, with addition
 void addition() {
 	struct syntax_node *save = tree_current;
-	accept(0, t_addsub, -1); // optional sign
 
-	// make a temporary node to attach the left hand side onto
-	struct syntax_node temp = {NULL, NULL, NULL};
-	tree_current = &temp;
+	// hold a node to attach the left hand side onto
+	tree_current = tree_hold();
+	accept(0, t_addsub, -1); // optional sign, which the term goes under
 	term();
 	tree_current = save;
 
 	struct syntax_node *operator = NULL;
 	if(accept(0, t_addsub, -1)) {
-		tree_add_child(tree_current, temp.child);
+		tree_add_child(tree_current, tree_unhold());
 		addition();
 	} else {
-		tree_add_child(save, temp.child);
+		tree_add_child(save, tree_unhold());
 	}
 	tree_current = save;
 }
@@ -260,21 +361,22 @@ void addition() {
 // The most outer level, with comparisons
 void expression() {
 	struct syntax_node *save = tree_current;
+	STATS_ENTER(expression_depth);
 
-	// make a temporary node to attach the left hand side onto
-	struct syntax_node temp = {NULL, NULL, NULL};
-	tree_current = &temp;
+	// hold a node to attach the left hand side onto
+	tree_current = tree_hold();
 	addition();
 	tree_current = save;
 
 	struct syntax_node *operator = NULL;
 	if(accept(0, t_logical, -1)) {
-		tree_add_child(tree_current, temp.child);
+		tree_add_child(tree_current, tree_unhold());
 		expression();
 	} else {
-		tree_add_child(save, temp.child);
+		tree_add_child(save, tree_unhold());
 	}
 	tree_current = save;
+	STATS_LEAVE(expression_depth);
 }
 
 void variable_declaration();
@@ -283,6 +385,7 @@ void function_definition();
 // One statement of any kind
 void statement() {
 	struct syntax_node *save = tree_current;
+	STATS_ENTER(statement_depth);
 
 	if(accept(0, t_var, -1)) {
 		variable_declaration();
@@ -294,9 +397,8 @@ void statement() {
 
 		// accept an array index if found
 		int left_is_array = 0;
-		struct syntax_node temp = {NULL, NULL, NULL};
 		if(accept(TEST, t_lsquare, -1)) {
-			tree_current = &temp;
+			tree_current = tree_hold();
 			left_is_array = 1;
 			array_index();
 			tree_current = identifier;
@@ -304,8 +406,10 @@ void statement() {
 		if(accept(0, t_assignment, -1)) { // assignment
 			struct syntax_node *assignment = tree_current;
 
-			if(left_is_array)
-				assignment->child = temp.child;
+			if(left_is_array) {
+				assignment->child = tree_unhold();
+				left_is_array = 0;
+			}
 
 			struct lexeme_token *identifier_token = identifier->token;
 			struct lexeme_token *assignment_token = assignment->token;
@@ -328,6 +432,9 @@ void statement() {
 			}
 			accept(NEEDED|OMIT, t_newline, -1);
 		}
+		// an index that didn't get assigned to doesn't go anywhere
+		if(left_is_array)
+			free_syntax_tree(tree_unhold());
 	} else if(accept(0, t_indent_in, -1)) {
 	// Multiple statements
 		while(!accept(OMIT, t_indent_out, -1))
@@ -368,11 +475,14 @@ void statement() {
 	} else if(accept(0, t_return, -1)) {
 		expression();
 		accept(NEEDED|OMIT, t_newline, -1);
+	} else if(accept(0, t_break, t_continue, -1)) {
+		accept(NEEDED|OMIT, t_newline, -1);
 	} else {
-		error("Bad token %s", token_print(token_current));
+		error("Bad token %s at %s", token_print(token_current), offset_print(token_current->offset));
 	}
 
 	tree_current = save;
+	STATS_LEAVE(statement_depth);
 }
 
 void variable_declaration() {
@@ -419,12 +529,14 @@ void function_definition() {
 
 // Run the syntactical analyzer
 void syntactical_analyzer(struct lexeme_token *list) {
+	STATS_BEGIN(PHASE_PARSE);
 	token_current = list;
+	tree_head = NULL;
 
 	while(token_current) {
 		tree_current = NULL; // NULL because it's in the global space
 
-		if(accept(OMIT, t_newline)) {
+		if(accept(OMIT, t_newline, -1)) {
 
 		} else if(accept(0, t_var, -1)) {
 			variable_declaration();
@@ -432,4 +544,5 @@ void syntactical_analyzer(struct lexeme_token *list) {
 			function_definition();
 		}
 	}
+	STATS_END(PHASE_PARSE);
 }
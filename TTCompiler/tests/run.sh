@@ -0,0 +1,21 @@
+#!/bin/sh
+# Compiles every script in tests with ttc and compares what it prints to the
+# .expected file next to the script. Run from TTCompiler after mk.bat has
+# built ttc. --update rewrites the .expected files from the current output.
+cd "$(dirname "$0")/.." || exit 1
+failed=0
+for script in tests/*.txt; do
+	expected="${script%.txt}.expected"
+	if [ "$1" = "--update" ]; then
+		./ttc "$script" > "$expected"
+		continue
+	fi
+	if ./ttc "$script" | diff -u "$expected" - > /dev/null; then
+		echo "ok      $script"
+	else
+		echo "FAILED  $script"
+		./ttc "$script" | diff -u "$expected" -
+		failed=1
+	fi
+done
+exit $failed
@@ -18,10 +18,19 @@
  */
 #include "ttc.h"
 
-// Error, so exit the whole program
+// Set while something can recover from an error, like watch mode compiling one file
+jmp_buf *error_handler = NULL;
+char error_text[256];
+
+// Error, so exit the whole program, or jump back to error_handler with the message in error_text
 void error(const char *format, ...) {
 	va_list argptr;
 	va_start(argptr, format);
+	if(error_handler) {
+		vsnprintf(error_text, sizeof(error_text), format, argptr);
+		va_end(argptr);
+		longjmp(*error_handler, 1);
+	}
 	printf("Error: ");
 	vprintf(format, argptr);
 	putchar('\n');
@@ -34,7 +43,15 @@ void print_parse_tree(struct syntax_node *node, int level) {
 	while(node) {
 		for(int i=0; i<level; i++)
 			printf("   ");
-		printf(token_print(node->token));
+		printf("%s", token_print(node->token));
+		if(node->flags & NODE_SPECIALIZED)
+			printf(" specialized %s", type_print(node->type));
+		if(node->flags & NODE_DEFERRED)
+			printf(" deferred");
+		if(node->flags & NODE_FLUSH)
+			printf(" flushes");
+		if(node->flags & NODE_REGION)
+			printf(" region");
 		putchar('\n');
 
 		if(node->child)
@@ -43,8 +60,77 @@ void print_parse_tree(struct syntax_node *node, int level) {
 	}
 }
 
+// Everything after parsing, on tree_head
+void compile_tree() {
+	lower_loops(tree_head);
+	build_function_table(tree_head);
+	inline_functions(&tree_head);
+	build_export_table();
+	build_global_table(tree_head);
+	mark_host_calls(tree_head);
+	infer_types(tree_head);
+	analyze_escapes(tree_head);
+}
+
+// Print the tables compile_tree made
+void print_results(FILE *out) {
+	fputs("\n\n\nFunction table:\n", out);
+	print_function_table(out);
+
+	fputs("\n\n\nExports:\n", out);
+	print_export_table(out);
+
+	fputs("\n\n\nGlobals:\n", out);
+	print_global_table(out);
+
+	fputs("\n\n\nInlining:\n", out);
+	print_inline_report(out);
+
+	fputs("\n\n\nTypes:\n", out);
+	print_type_report(out);
+
+	fputs("\n\n\nEscapes:\n", out);
+	print_escape_report(out);
+
+	int line_table_size = line_table_encode(NULL);
+	unsigned char *line_table = (unsigned char*)malloc(line_table_size);
+	line_table_encode(line_table);
+	fprintf(out, "\n\n\nLine table (%d bytes):\n", line_table_size);
+	for(int i=0; i<line_table_size; i++)
+		fprintf(out, "%02x%c", line_table[i], (i % 16 == 15 || i == line_table_size-1) ? '\n' : ' ');
+	free(line_table);
+}
+
 int main(int argc, char *argv[]) {
-	FILE *File = fopen("test.txt", "rb");
+	const char *filename = "test.txt";
+	const char *watch = NULL;
+	int show_stats = 0;
+
+	for(int i=1; i<argc; i++) {
+		if(!strcmp(argv[i], "--stats"))
+			show_stats = 1;
+		else if(!strcmp(argv[i], "--no-intern"))
+			use_intern_pool = 0;
+		else if(!strcmp(argv[i], "--inline-limit") && i+1 < argc)
+			inline_max_nodes = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--watch") && i+1 < argc)
+			watch = argv[++i];
+		else
+			filename = argv[i];
+	}
+#ifndef TTC_STATS
+	if(show_stats)
+		error("--stats needs the compiler to be built with -DTTC_STATS");
+#endif
+	if(watch) {
+		watch_directory(watch, show_stats);
+		return 0;
+	}
+
+	FILE *File = fopen(filename, "rb");
+	if(!File)
+		error("Can't open %s", filename);
+	stats_reset();
 
 	struct lexeme_token *list = lexical_analyzer(File);
 	convert_indents(list);
@@ -64,5 +150,15 @@ int main(int argc, char *argv[]) {
 	puts("\n\n\nSyntax tree:");
 	print_parse_tree(tree_head, 0);
 
+	compile_tree();
+	puts("\n\n\nLowered tree:");
+	print_parse_tree(tree_head, 0);
+	print_results(stdout);
+
+	if(show_stats) {
+		puts("\n\n\nStatistics:");
+		stats_print(stdout, &compile_stats);
+	}
+
 	fclose(File);
 }
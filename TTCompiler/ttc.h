@@ -21,11 +21,14 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <setjmp.h>
+#include "../TTRuntime/events.h"
 
 // Data structure for a symbol table entry
 struct symbol_data {
 	const char *lexeme;
 	int token_category;
+	int intern_id;          // ID in the intern pool, or 0 if the lexeme is this symbol's own copy
 	struct symbol_data *next;
 };
 
@@ -33,14 +36,51 @@ struct symbol_data {
 struct lexeme_token {
 	int token_category;         // which token category
 	int token_value;            // which token in the token category
+	int offset;                 // byte offset in the source, see source_position()
 	struct symbol_data *symbol; // symbol table entry
 	struct lexeme_token *next;
 };
 
-// Node for the syntax tree
+// Node for the syntax tree, its source position is the position of its token
 struct syntax_node {
   struct lexeme_token *token;
   struct syntax_node *child, *next;
+  unsigned char type;  // set of TYPE_ bits the value can have, from infer_types()
+  unsigned char flags; // NODE_ flags
+};
+
+enum node_flags {
+	NODE_SPECIALIZED = 1, // operand types are proven, no runtime type check needed
+	NODE_DEFERRED    = 2, // host call goes into the command buffer instead of running now
+	NODE_FLUSH       = 4, // host call reads the world, so it may need the command buffer applied first
+	NODE_REGION      = 8, // list or string it makes never outlives the hook invocation
+};
+
+// Types as bits in a set
+enum value_types {
+	TYPE_INTEGER  = 1,
+	TYPE_REAL     = 2,
+	TYPE_STRING   = 4,
+	TYPE_LIST     = 8,
+	TYPE_BOOLEAN  = 16,
+	TYPE_NONE     = 32,
+	TYPE_FUNCTION = 64,
+	TYPE_ANY      = 127,
+
+	TYPE_SAME_AS_ARGUMENT = 128, // builtin returns the type of its first argument
+};
+
+// A function the host provides
+struct builtin_info {
+	const char *name;
+	int arguments;  // -1 for any number
+	int returns;    // TYPE_ bits
+	int flags;      // BUILTIN_ bits
+};
+
+enum builtin_flags {
+	BUILTIN_MUTATES = 1, // changes the map, can be put off until the end of the hook
+	BUILTIN_QUERIES = 2, // reads the map, so it has to see the changes made before it
 };
 
 enum token_category {
@@ -88,17 +128,215 @@ enum token_category {
 	t_indent_in,
 	t_indent_out,
 
+	// only made by lowering, never by the lexer
+	t_range_loop,    // for n = a to b step c, bounds evaluated once, numeric counter
+	t_each_loop,     // for n in list
+
 	t_max_tokens,
 
 	t_first_keyword = t_if,
 	t_last_keyword = t_return,
 };
 
+// ----- COMPILE STATISTICS -----
+// Counters are only compiled in when TTC_STATS is defined, so a build
+// without it pays nothing for them. Phase times are in nanoseconds.
+
+enum stats_phase {
+	PHASE_LEX,
+	PHASE_INDENT,
+	PHASE_PARSE,
+	PHASE_LOWER,
+	PHASE_FUNCTIONS,
+	PHASE_INLINE,
+	PHASE_EXPORTS,
+	PHASE_TYPES,
+	PHASE_ESCAPE,
+
+	PHASE_COUNT
+};
+
+struct compile_stats {
+	double phase_ns[PHASE_COUNT];
+	long tokens, symbols, nodes;
+	long symbol_lookups;       // calls to find_symbol
+	long symbol_probes;        // entries compared in all of those lookups
+	long symbol_probe_max;     // longest single lookup
+	long alloc_bytes, alloc_count;
+	int statement_depth, statement_depth_max;
+	int expression_depth, expression_depth_max;
+	long range_loops, unrolled_loops, each_loops;
+	long inlined_calls, removed_functions;
+	long deferred_calls, flush_calls;
+	long region_sites, heap_sites;
+	long intern_saved_bytes;  // bytes not allocated because the intern pool already had the lexeme
+};
+
+#ifdef TTC_STATS
+#define STATS_ADD(field, amount) (compile_stats.field += (amount))
+#define STATS_MAX(field, value)  do { if((value) > compile_stats.field) compile_stats.field = (value); } while(0)
+#define STATS_ALLOC(bytes)       (compile_stats.alloc_bytes += (bytes), compile_stats.alloc_count++)
+#define STATS_ENTER(depth)       do { if(++compile_stats.depth > compile_stats.depth##_max) compile_stats.depth##_max = compile_stats.depth; } while(0)
+#define STATS_LEAVE(depth)       (compile_stats.depth--)
+#define STATS_BEGIN(phase)       double stats_start_##phase = stats_now()
+#define STATS_END(phase)         (compile_stats.phase_ns[phase] += stats_now() - stats_start_##phase)
+#else
+#define STATS_ADD(field, amount) ((void)0)
+#define STATS_MAX(field, value)  ((void)0)
+#define STATS_ALLOC(bytes)       ((void)0)
+#define STATS_ENTER(depth)       ((void)0)
+#define STATS_LEAVE(depth)       ((void)0)
+#define STATS_BEGIN(phase)       ((void)0)
+#define STATS_END(phase)         ((void)0)
+#endif
+
+// ----- INTERN POOL -----
+// Function, global and hook key names in the tables below carry their
+// intern IDs, which are 0 when the pool is turned off.
+
+const char *intern_string(const char *text, int *id, int *added);
+const char *intern_text(int id);
+void intern_pool_stats(long *strings, long *bytes, long *saved);
+void intern_pool_free();
+extern int use_intern_pool;
+
+double stats_now();
+void stats_reset();
+void stats_print(FILE *out, struct compile_stats *stats);
+
+extern struct compile_stats compile_stats;
+extern const char *stats_phase_names[PHASE_COUNT];
+
 struct lexeme_token *lexical_analyzer(FILE *File);
 void syntactical_analyzer(struct lexeme_token *list);
 void convert_indents(struct lexeme_token *list);
 void error(const char *format, ...);
+extern jmp_buf *error_handler;
+extern char error_text[256];
 const char *token_print(struct lexeme_token *token);
+void source_position(int offset, int *line, int *column);
+const char *offset_print(int offset);
+int line_table_encode(unsigned char *out);
+int line_table_decode(const unsigned char *in, int **starts);
+void free_token_list(struct lexeme_token *list);
+void free_symbol_table();
+void free_syntax_tree(struct syntax_node *node);
+struct syntax_node *tree_make(struct lexeme_token *token);
+struct syntax_node *tree_copy(struct syntax_node *node);
+struct syntax_node *tree_hold();
+struct syntax_node *tree_unhold();
+void free_held_trees();
+struct lexeme_token *token_make(int token_category, struct symbol_data *symbol, int offset);
+void free_made_tokens();
+struct symbol_data *find_symbol(const char *lexeme, int token_category, int auto_create);
+void lower_loops(struct syntax_node *tree);
+int count_tree(struct syntax_node *node);
+
+// ----- FUNCTION TABLE -----
+
+// One def in the program
+struct function_info {
+	const char *name;
+	int name_id;                        // intern ID of the name
+	struct syntax_node *node;           // the def node
+	struct syntax_node *parameter_list; // the ( node, parameters are its children
+	struct syntax_node *body;
+	int parameters;
+	int first_line, last_line;
+	int sample_points;
+	long cost;                          // most steps it can take, or COST_UNBOUNDED
+	long entry_steps;                   // fuel to charge on entry, loops inside charge their own
+};
+
+#define COST_UNBOUNDED -1
+
+enum sample_point_kind {
+	SAMPLE_LOOP,  // backward branch at the end of a while, until or for body
+	SAMPLE_CALL,  // a function call
+};
+
+// A place where the runtime checks whether a profiler sample is due and
+// whether the invocation has run out of fuel
+struct sample_point {
+	int function;  // index into function_table
+	int kind;
+	int line;
+	long steps;    // fuel to charge each time it's reached
+	struct syntax_node *node;
+};
+
+struct builtin_info *find_builtin(const char *name);
+void mark_host_calls(struct syntax_node *tree);
+void analyze_escapes(struct syntax_node *tree);
+void free_escape_summaries();
+void print_escape_report(FILE *out);
+void infer_types(struct syntax_node *tree);
+void print_type_report(FILE *out);
+const char *type_print(int type);
+
+void build_function_table(struct syntax_node *tree);
+void print_function_table(FILE *out);
+int find_function(const char *name);
+int node_line(struct syntax_node *node);
+int is_call(struct syntax_node *node);
+
+void inline_functions(struct syntax_node **tree);
+void print_inline_report(FILE *out);
+int is_local(struct function_info *function, struct syntax_node *node, struct symbol_data *symbol);
+extern int inline_max_nodes;
+
+// ----- EXPORT TABLE -----
+
+// A function name the host calls, and how many arguments it passes
+struct hook_info {
+	const char *name;
+	int event;
+	int arguments;
+	int prefix;         // name is a prefix, and the rest of the function name is the key
+};
+
+// One function the host can call
+struct export_info {
+	int event;
+	const char *key;    // item name for use_item_ hooks, otherwise NULL
+	int key_id;         // intern ID of the key
+	int function;       // index into function_table
+};
+
+struct hook_info *find_hook(const char *name);
+int is_hook_name(const char *name);
+void build_export_table();
+void print_export_table(FILE *out);
+
+extern struct export_info *export_table;
+extern int export_count;
+extern const char *event_names[EVENT_COUNT];
+
+// A top level variable
+struct global_info {
+	const char *name;
+	int name_id;                // intern ID of the name
+	struct syntax_node *node;   // the name under the var node, its child is the initial value
+	int line;
+};
+
+void build_global_table(struct syntax_node *tree);
+void print_global_table(FILE *out);
+
+extern struct global_info *global_table;
+extern int global_count;
+
+// ----- WATCH MODE -----
+
+void compile_tree();
+void print_results(FILE *out);
+void watch_directory(const char *directory, int show_stats);
+
+extern struct function_info *function_table;
+extern int function_count;
+extern struct sample_point *sample_points;
+extern int sample_point_count;
+extern const char *sample_point_kinds[];
 
 extern const char *token_strings[t_max_tokens][20];
 extern struct symbol_data *symbol_table;
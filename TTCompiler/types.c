@@ -0,0 +1,423 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- TYPE INFERENCE -----
+// Works out which types each local variable can have at each point in a
+// function, going through the statements in order. A type is a set of bits,
+// and a value whose set has only one bit in it has a proven type. Operators
+// whose operands are all proven get marked NODE_SPECIALIZED so the back end
+// can use an opcode that skips the runtime type check.
+//
+// Only parameters, var declarations and loop counters of the function being
+// looked at are tracked. Globals can be changed by any call, so they're TYPE_ANY.
+
+#define MAX_TRACKED 64 // locals past this many are just TYPE_ANY
+
+struct type_env {
+	int count;
+	struct symbol_data *symbols[MAX_TRACKED];
+	unsigned char types[MAX_TRACKED];
+};
+
+int type_operations = 0;  // operators in the program
+int type_specialized = 0; // operators that got NODE_SPECIALIZED
+
+const char *type_names[] = {"integer", "real", "string", "list", "boolean", "none", "function"};
+
+// Makes a string representation of a set of types
+const char *type_print(int type) {
+	static char buffer[80];
+	if(type == TYPE_ANY)
+		return "any";
+	buffer[0] = 0;
+	for(int i=0; i<7; i++)
+		if(type & (1 << i)) {
+			if(buffer[0])
+				strcat(buffer, "|");
+			strcat(buffer, type_names[i]);
+		}
+	return buffer;
+}
+
+// Does this set of types have exactly one type in it?
+int is_proven(int type) {
+	return type && !(type & (type - 1));
+}
+
+// ----- ENVIRONMENT -----
+
+int env_find(struct type_env *env, struct symbol_data *symbol) {
+	for(int i=0; i<env->count; i++)
+		if(env->symbols[i] == symbol)
+			return i;
+	return -1;
+}
+
+// Start tracking a local, or update it if it's already tracked
+void env_set(struct type_env *env, struct symbol_data *symbol, int type) {
+	int index = env_find(env, symbol);
+	if(index < 0) {
+		if(env->count == MAX_TRACKED)
+			return;
+		index = env->count++;
+		env->symbols[index] = symbol;
+	}
+	env->types[index] = type;
+}
+
+// Update a local only if it's tracked
+void env_assign(struct type_env *env, struct symbol_data *symbol, int type) {
+	int index = env_find(env, symbol);
+	if(index >= 0)
+		env->types[index] = type;
+}
+
+int env_get(struct type_env *env, struct symbol_data *symbol) {
+	int index = env_find(env, symbol);
+	return index >= 0 ? env->types[index] : TYPE_ANY;
+}
+
+// Merge two paths the program could have taken; returns 1 if into changed
+int env_join(struct type_env *into, struct type_env *other) {
+	int changed = 0;
+	for(int i=0; i<other->count; i++) {
+		int index = env_find(into, other->symbols[i]);
+		if(index < 0) {
+			// only declared on one path, so it could still be unset on the other
+			env_set(into, other->symbols[i], other->types[i] | TYPE_NONE);
+			changed = 1;
+		} else if((into->types[index] | other->types[i]) != into->types[index]) {
+			into->types[index] |= other->types[i];
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+// ----- EXPRESSIONS -----
+
+int infer_expression(struct syntax_node *node, struct type_env *env);
+
+// Infer every expression in a list, returning the type of the first one
+int infer_arguments(struct syntax_node *node, struct type_env *env) {
+	int first = TYPE_NONE;
+	for(int i=0; node; node = node->next, i++) {
+		int type = infer_expression(node, env);
+		if(!i)
+			first = type;
+	}
+	return first;
+}
+
+// Mark an operator as specialized if its operand types are enough to pick an opcode.
+// right is 0 for operators with only one operand
+void specialize(struct syntax_node *node, int left, int right) {
+	int category = node->token->token_category;
+	int proven = 0;
+	int numbers = TYPE_INTEGER | TYPE_REAL;
+
+	if(category == t_unary) {
+		// ! needs a boolean, ~ needs an integer
+		proven = node->token->token_value == 1 ? left == TYPE_BOOLEAN : left == TYPE_INTEGER;
+	} else if(!right) {
+		// leading sign
+		proven = is_proven(left) && (left & numbers);
+	} else if(category == t_shift || category == t_bitmath) {
+		proven = left == TYPE_INTEGER && right == TYPE_INTEGER;
+	} else if(category == t_logical) {
+		proven = is_proven(left) && is_proven(right) && (left == right || ((left | right) & ~numbers) == 0);
+	} else {
+		// arithmetic works on two numbers, + also joins two strings or two lists
+		int plus = category == t_addsub && node->token->token_value == 1;
+		proven = is_proven(left) && is_proven(right) && (((left | right) & ~numbers) == 0
+			|| (plus && left == right && (left == TYPE_STRING || left == TYPE_LIST)));
+	}
+	// loop bodies get looked at more than once, and only the last time counts
+	if(proven)
+		node->flags |= NODE_SPECIALIZED;
+	else
+		node->flags &= ~NODE_SPECIALIZED;
+}
+
+// Type of an arithmetic result
+int arithmetic_type(struct syntax_node *node, int left, int right) {
+	int numbers = TYPE_INTEGER | TYPE_REAL;
+	int category = node->token->token_category;
+	if(!right) // leading sign
+		return left & numbers ? left & numbers : TYPE_ANY;
+	if(category == t_addsub && node->token->token_value == 1 && ((left | right) & (TYPE_STRING | TYPE_LIST))) {
+		if(left == TYPE_STRING || right == TYPE_STRING)
+			return TYPE_STRING;
+		if(left == TYPE_LIST && right == TYPE_LIST)
+			return TYPE_LIST;
+		return TYPE_ANY;
+	}
+	if(left == TYPE_INTEGER && right == TYPE_INTEGER) {
+		// dividing two integers may not give an integer
+		if(category == t_muldiv && node->token->token_value == 2)
+			return numbers;
+		return TYPE_INTEGER;
+	}
+	if(!((left | right) & ~numbers))
+		return TYPE_REAL | (left & right & TYPE_INTEGER);
+	return TYPE_ANY;
+}
+
+int infer_node(struct syntax_node *node, struct type_env *env) {
+	struct lexeme_token *token = node->token;
+	int left, right;
+
+	switch(token->token_category) {
+		case t_integer: return TYPE_INTEGER;
+		case t_real:    return TYPE_REAL;
+		case t_string:  return TYPE_STRING;
+		case t_true: case t_false: return TYPE_BOOLEAN;
+		case t_none:    return TYPE_NONE;
+		case t_lsquare: // list literal
+			infer_arguments(node->child, env);
+			return TYPE_LIST;
+
+		case t_identifier:
+			if(is_call(node)) {
+				int first = infer_arguments(node->child->child, env);
+				struct builtin_info *builtin = find_builtin(token->symbol->lexeme);
+				if(!builtin)
+					return TYPE_ANY;
+				return builtin->returns == TYPE_SAME_AS_ARGUMENT ? first : builtin->returns;
+			}
+			if(node->child) { // indexing into a list
+				infer_arguments(node->child->child, env);
+				return TYPE_ANY;
+			}
+			if(env_find(env, token->symbol) < 0 && find_function(token->symbol->lexeme) >= 0)
+				return TYPE_FUNCTION;
+			return env_get(env, token->symbol);
+
+		case t_addsub: case t_muldiv: case t_shift: case t_bitmath:
+			left = infer_expression(node->child, env);
+			right = node->child && node->child->next ? infer_expression(node->child->next, env) : 0;
+			specialize(node, left, right);
+			if(token->token_category == t_shift || token->token_category == t_bitmath)
+				return TYPE_INTEGER;
+			return arithmetic_type(node, left, right);
+
+		case t_logical:
+			left = infer_expression(node->child, env);
+			right = infer_expression(node->child->next, env);
+			specialize(node, left, right);
+			return TYPE_BOOLEAN;
+
+		case t_unary:
+			left = infer_expression(node->child, env);
+			specialize(node, left, 0);
+			return token->token_value == 1 ? TYPE_BOOLEAN : TYPE_INTEGER;
+	}
+	infer_arguments(node->child, env);
+	return TYPE_ANY;
+}
+
+int infer_expression(struct syntax_node *node, struct type_env *env) {
+	if(!node)
+		return TYPE_NONE;
+	node->type = infer_node(node, env);
+	return node->type;
+}
+
+// ----- STATEMENTS -----
+
+void infer_statements(struct syntax_node *node, struct type_env *env);
+
+// Types at each break and continue in the loop being looked at. A continue
+// goes back to the top of the loop and a break goes to whatever's after it,
+// so both are more ways to get there than just reaching the end of the body
+struct loop_exits {
+	struct type_env breaks, continues;
+	int any_breaks, any_continues;
+	struct loop_exits *outer;
+};
+
+struct loop_exits *current_loop = NULL;
+
+void loop_exit(struct type_env *env, int is_break) {
+	if(!current_loop)
+		return;
+	if(is_break) {
+		if(current_loop->any_breaks)
+			env_join(&current_loop->breaks, env);
+		else
+			current_loop->breaks = *env;
+		current_loop->any_breaks = 1;
+	} else {
+		if(current_loop->any_continues)
+			env_join(&current_loop->continues, env);
+		else
+			current_loop->continues = *env;
+		current_loop->any_continues = 1;
+	}
+}
+
+// Run a loop body until the types going into it stop changing.
+// Sets can only grow and there are only so many bits, so this ends.
+void infer_loop(struct syntax_node *condition, struct syntax_node *body, struct type_env *env,
+		struct symbol_data *counter, int counter_type) {
+	struct loop_exits exits;
+	exits.outer = current_loop;
+	current_loop = &exits;
+	while(1) {
+		struct type_env inside = *env;
+		exits.any_breaks = exits.any_continues = 0;
+		if(counter)
+			env_set(&inside, counter, counter_type);
+		infer_expression(condition, &inside);
+		infer_statements(body, &inside);
+		int changed = env_join(env, &inside);
+		if(exits.any_continues)
+			changed |= env_join(env, &exits.continues);
+		if(!changed)
+			break;
+	}
+	current_loop = exits.outer;
+	if(counter)
+		env_set(env, counter, counter_type | TYPE_NONE);
+	// the last time through saw the final types, so its breaks are the ones to use
+	if(exits.any_breaks)
+		env_join(env, &exits.breaks);
+}
+
+void infer_statement(struct syntax_node *node, struct type_env *env) {
+	struct syntax_node *child = node->child;
+	struct type_env branch;
+
+	switch(node->token->token_category) {
+		case t_def: // gets looked at on its own
+			return;
+		case t_var:
+			for(struct syntax_node *name = child; name; name = name->next)
+				env_set(env, name->token->symbol, name->child ? infer_expression(name->child, env) : TYPE_NONE);
+			return;
+		case t_assignment:
+			// = -> target, value
+			if(child->child) { // storing into a list element
+				infer_arguments(child->child->child, env);
+				infer_expression(child->next, env);
+			} else {
+				env_assign(env, child->token->symbol, infer_expression(child->next, env));
+			}
+			return;
+		case t_if: case t_elif:
+			infer_expression(child, env);
+			branch = *env;
+			infer_statements(child->next, &branch);
+			env_join(env, &branch);
+			return;
+		case t_else:
+			branch = *env;
+			infer_statements(child, &branch);
+			env_join(env, &branch);
+			return;
+		case t_while: case t_until:
+			infer_loop(child, child->next, env, NULL, 0);
+			return;
+		case t_range_loop: {
+			// range loop -> counter, start, end, step, body
+			// the counter starts out as start and has step added to it, and it's compared
+			// against end, so it's only an integer if all three are
+			int start = infer_expression(child->next, env);
+			int end = infer_expression(child->next->next, env);
+			int step = infer_expression(child->next->next->next, env);
+			int counter = start | end | step;
+			node->type = counter;
+			if(counter == TYPE_INTEGER)
+				node->flags |= NODE_SPECIALIZED; // the counter can have an integer slot
+			else
+				node->flags &= ~NODE_SPECIALIZED;
+			infer_loop(NULL, child->next->next->next->next, env, child->token->symbol, counter);
+			return;
+		}
+		case t_each_loop:
+			// each loop -> counter, list, body
+			infer_expression(child->next, env);
+			infer_loop(NULL, child->next->next, env, child->token->symbol, TYPE_ANY);
+			return;
+		case t_for:
+			// a range loop that couldn't be lowered: for -> counter, = or in, body
+			infer_arguments(child->next->child, env);
+			infer_loop(NULL, child->next->next, env, child->token->symbol, TYPE_ANY);
+			return;
+		case t_indent_in:
+			infer_statements(child, env);
+			return;
+		case t_return:
+			infer_expression(child, env);
+			return;
+		case t_break: case t_continue:
+			loop_exit(env, node->token->token_category == t_break);
+			return;
+	}
+	// anything else is an expression used as a statement, like a call
+	infer_expression(node, env);
+}
+
+void infer_statements(struct syntax_node *node, struct type_env *env) {
+	for(; node; node = node->next)
+		infer_statement(node, env);
+}
+
+// Count the operators and how many of them were specialized
+void count_operations(struct syntax_node *node) {
+	for(; node; node = node->next) {
+		switch(node->token->token_category) {
+			case t_addsub: case t_muldiv: case t_logical: case t_shift: case t_bitmath: case t_unary:
+				type_operations++;
+				if(node->flags & NODE_SPECIALIZED)
+					type_specialized++;
+				break;
+		}
+		count_operations(node->child);
+	}
+}
+
+// Infer types for every function and the global statements
+void infer_types(struct syntax_node *tree) {
+	STATS_BEGIN(PHASE_TYPES);
+	struct type_env env;
+
+	current_loop = NULL; // in case the last compile stopped partway through
+	env.count = 0;
+	infer_statements(tree, &env);
+
+	for(int i=0; i<function_count; i++) {
+		env.count = 0;
+		for(struct syntax_node *parameter = function_table[i].parameter_list->child; parameter; parameter = parameter->next)
+			env_set(&env, parameter->token->symbol, TYPE_ANY);
+		infer_statements(function_table[i].body, &env);
+	}
+
+	type_operations = 0;
+	type_specialized = 0;
+	count_operations(tree);
+	STATS_END(PHASE_TYPES);
+}
+
+// Print how many operators could be specialized
+void print_type_report(FILE *out) {
+	fprintf(out, "%d of %d operations specialized (%.1f%%)\n", type_specialized, type_operations,
+		type_operations ? type_specialized * 100.0 / type_operations : 0.0);
+}
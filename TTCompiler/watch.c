@@ -0,0 +1,315 @@
+/*
+ * Tilemap Town scripting compiler
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttc.h"
+
+// ----- WATCH MODE -----
+// ttc --watch <directory> compiles every .txt script in a directory, then
+// stays running and recompiles scripts as they're saved. Editors often write
+// a file several times in a row when saving, so changes are collected until
+// the directory has been quiet for WATCH_QUIET_MS, and each changed file is
+// compiled once.
+//
+// The compiler stays loaded between rounds: the intern pool, the builtin and
+// hook tables, and the function, export and global tables (which keep their
+// capacity) are all reused, so one file turns around in about the time it
+// takes to compile it. The compiler's tables are global, so files are
+// compiled one after another rather than in parallel.
+//
+// Results go in a .ttc directory inside the watched one: name.txt.out has the
+// tables for each script, or the error that stopped it. .ttc/cache has a hash
+// of each script's contents, so a file that was saved without changes, or
+// that hasn't changed since the last time ttc ran, isn't compiled again. Both
+// are written as each file finishes, not at the end of a round.
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#define WATCH_QUIET_MS 50
+#define WATCH_RESULTS  ".ttc"
+
+struct watch_file {
+	char *name;
+	unsigned long long hash;
+	int compiled;      // hash is for a compile that finished, or came from the cache
+	int failed;
+	int pending;       // changed since the last round
+};
+
+struct watch_file *watch_files = NULL;
+int watch_file_count = 0, watch_file_capacity = 0;
+const char *watch_root;
+
+int is_script_name(const char *name) {
+	size_t length = strlen(name);
+	return name[0] != '.' && length > 4 && !strcmp(name + length - 4, ".txt");
+}
+
+struct watch_file *watch_find(const char *name, int create) {
+	for(int i=0; i<watch_file_count; i++)
+		if(!strcmp(watch_files[i].name, name))
+			return &watch_files[i];
+	if(!create)
+		return NULL;
+	if(watch_file_count == watch_file_capacity) {
+		watch_file_capacity = watch_file_capacity ? watch_file_capacity * 2 : 32;
+		watch_files = (struct watch_file*)realloc(watch_files, watch_file_capacity * sizeof(struct watch_file));
+		if(!watch_files)
+			error("Can't allocate watch list");
+	}
+	struct watch_file *file = &watch_files[watch_file_count++];
+	memset(file, 0, sizeof(struct watch_file));
+	file->name = strdup(name);
+	return file;
+}
+
+void watch_forget(struct watch_file *file) {
+	free(file->name);
+	*file = watch_files[--watch_file_count];
+}
+
+// path to a file in the watched directory, or in .ttc if results is set
+const char *watch_path(const char *name, const char *suffix, int results) {
+	static char path[4096];
+	snprintf(path, sizeof(path), "%s/%s%s%s", watch_root, results ? WATCH_RESULTS "/" : "", name, suffix);
+	return path;
+}
+
+// FNV-1a over the whole file
+unsigned long long hash_file(FILE *File) {
+	unsigned long long hash = 14695981039346656037ull;
+	unsigned char buffer[4096];
+	size_t got;
+	while((got = fread(buffer, 1, sizeof(buffer), File)) > 0)
+		for(size_t i=0; i<got; i++)
+			hash = (hash ^ buffer[i]) * 1099511628211ull;
+	return hash;
+}
+
+// ----- CACHE -----
+// One line per script: hash, 1 if it had an error, name
+
+void load_cache() {
+	FILE *cache = fopen(watch_path("cache", "", 1), "rb");
+	if(!cache)
+		return;
+	char name[1024];
+	unsigned long long hash;
+	int failed;
+	while(fscanf(cache, "%llx %d %1023[^\n]\n", &hash, &failed, name) == 3) {
+		struct watch_file *file = watch_find(name, 1);
+		file->hash = hash;
+		file->failed = failed;
+		file->compiled = 1;
+	}
+	fclose(cache);
+}
+
+// Written to a temporary file and renamed, so it's never seen half written
+void save_cache() {
+	char temporary[4096];
+	snprintf(temporary, sizeof(temporary), "%s", watch_path("cache", ".tmp", 1));
+	FILE *cache = fopen(temporary, "wb");
+	if(!cache) {
+		printf("Can't write %s\n", temporary);
+		return;
+	}
+	for(int i=0; i<watch_file_count; i++)
+		if(watch_files[i].compiled)
+			fprintf(cache, "%016llx %d %s\n", watch_files[i].hash, watch_files[i].failed, watch_files[i].name);
+	fclose(cache);
+	rename(temporary, watch_path("cache", "", 1));
+}
+
+// ----- COMPILING -----
+
+// Free everything one compile made, so the next one starts from scratch
+void reset_compiler() {
+	free_syntax_tree(tree_head);
+	tree_head = NULL;
+	tree_current = NULL;
+	free_held_trees();
+	free_escape_summaries();
+	free_token_list(token_list);
+	token_list = NULL;
+	token_current = NULL;
+	free_made_tokens();
+	free_symbol_table();
+}
+
+// Compile one script if it changed. Returns 1 if it was compiled
+int watch_compile(struct watch_file *file, int show_stats) {
+	FILE *File = fopen(watch_path(file->name, "", 0), "rb");
+	if(!File) {
+		// deleted, or renamed away
+		unlink(watch_path(file->name, ".out", 1));
+		printf("%s: removed\n", file->name);
+		watch_forget(file);
+		save_cache();
+		return 0;
+	}
+	unsigned long long hash = hash_file(File);
+	if(file->compiled && file->hash == hash && !access(watch_path(file->name, ".out", 1), F_OK)) {
+		fclose(File);
+		return 0;
+	}
+	rewind(File);
+
+	char temporary[4096];
+	snprintf(temporary, sizeof(temporary), "%s", watch_path(file->name, ".out.tmp", 1));
+	FILE *out = fopen(temporary, "wb");
+	if(!out) {
+		printf("Can't write %s\n", temporary);
+		fclose(File);
+		return 0;
+	}
+
+	double start = stats_now();
+	jmp_buf handler;
+	stats_reset();
+	if(!setjmp(handler)) {
+		error_handler = &handler;
+		struct lexeme_token *list = lexical_analyzer(File);
+		convert_indents(list);
+		syntactical_analyzer(list);
+		compile_tree();
+		error_handler = NULL;
+		file->failed = 0;
+		fprintf(out, "%s", file->name);
+		print_results(out);
+		if(show_stats) {
+			fputs("\n\n\nStatistics:\n", out);
+			stats_print(out, &compile_stats);
+		}
+	} else {
+		error_handler = NULL;
+		file->failed = 1;
+		fprintf(out, "Error: %s\n", error_text);
+	}
+	double milliseconds = (stats_now() - start) / 1000000.0;
+	reset_compiler();
+	fclose(File);
+	fclose(out);
+	rename(temporary, watch_path(file->name, ".out", 1));
+
+	file->hash = hash;
+	file->compiled = 1;
+	save_cache();
+	if(file->failed)
+		printf("%s: Error: %s (%.2f ms)\n", file->name, error_text, milliseconds);
+	else
+		printf("%s: ok, %d functions, %d hooks (%.2f ms)\n", file->name, function_count, export_count, milliseconds);
+	fflush(stdout);
+	return 1;
+}
+
+// Compile everything that's pending
+void watch_round(int show_stats) {
+	int compiled = 0, unchanged = 0, failed = 0;
+	double start = stats_now();
+	for(int i=0; i<watch_file_count; ) {
+		struct watch_file *file = &watch_files[i];
+		if(!file->pending) {
+			i++;
+			continue;
+		}
+		file->pending = 0;
+		int count = watch_file_count;
+		if(watch_compile(file, show_stats)) {
+			compiled++;
+			failed += file->failed;
+		} else if(watch_file_count == count) {
+			unchanged++;
+		}
+		// a removed file has had the last one moved into its place, so look at i again
+		if(watch_file_count == count)
+			i++;
+	}
+	if(compiled)
+		printf("%d compiled, %d with errors, %d unchanged (%.2f ms)\n", compiled, failed, unchanged, (stats_now() - start) / 1000000.0);
+	fflush(stdout);
+}
+
+// ----- WATCHING -----
+
+// Mark files named in inotify events as pending. Returns 0 if there was nothing to read
+int read_events(int watcher) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t got = read(watcher, buffer, sizeof(buffer));
+	if(got <= 0)
+		return 0;
+	for(char *next = buffer; next < buffer + got; ) {
+		struct inotify_event *event = (struct inotify_event*)next;
+		if(event->mask & IN_IGNORED)
+			error("%s went away", watch_root);
+		if(event->len && is_script_name(event->name))
+			watch_find(event->name, 1)->pending = 1;
+		next += sizeof(struct inotify_event) + event->len;
+	}
+	return 1;
+}
+
+void watch_directory(const char *directory, int show_stats) {
+	watch_root = directory;
+	DIR *dir = opendir(directory);
+	if(!dir)
+		error("Can't open directory %s", directory);
+	mkdir(watch_path("", "", 1), 0777);
+
+	// watch before the first round, so nothing saved during it is missed
+	int watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watcher < 0 || inotify_add_watch(watcher, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF) < 0)
+		error("Can't watch %s", directory);
+
+	// everything in the cache or the directory gets looked at once
+	load_cache();
+	for(int i=0; i<watch_file_count; i++)
+		watch_files[i].pending = 1;
+	for(struct dirent *entry; (entry = readdir(dir)); )
+		if(is_script_name(entry->d_name))
+			watch_find(entry->d_name, 1)->pending = 1;
+	closedir(dir);
+	watch_round(show_stats);
+	printf("Watching %s, %d scripts\n", directory, watch_file_count);
+	fflush(stdout);
+
+	struct pollfd poller = {watcher, POLLIN, 0};
+	while(1) {
+		if(poll(&poller, 1, -1) < 0)
+			continue;
+		while(read_events(watcher))
+			;
+		// wait for the saves to stop
+		while(poll(&poller, 1, WATCH_QUIET_MS) > 0)
+			while(read_events(watcher))
+				;
+		watch_round(show_stats);
+	}
+}
+
+#else
+
+void watch_directory(const char *directory, int show_stats) {
+	error("--watch uses inotify, so it only works on Linux");
+}
+
+#endif
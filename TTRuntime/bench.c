@@ -0,0 +1,1193 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+// Benchmarks for the runtime pieces. Each one prints a line of JSON so
+// results can be compared across commits, same as ttcbench.
+
+// ----- TIMING AND MEMORY -----
+
+// Nanoseconds from some fixed point in the past
+double bench_now() {
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart * 1e9 / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+#endif
+}
+
+// Peak resident set size of the whole process so far, in kilobytes
+long peak_rss_kb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+#endif
+}
+
+// xorshift64*, so the same seed gives the same run on every platform
+uint64_t random_state;
+
+uint32_t random_next() {
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Values to hand to the runtime
+struct script_value integer_value(long integer) {
+	struct script_value value = {VALUE_INTEGER, {.integer = integer}};
+	return value;
+}
+
+struct script_value pointer_value(int type, void *pointer) {
+	struct script_value value = {type, {.pointer = pointer}};
+	return value;
+}
+
+// ----- TIMERS -----
+
+// Every TIMER_LIST_EVERY timers, one also gets a list like bomb_explode's,
+// alternating between one from a region that's reset and reused right
+// after, and a heap one that the caller lets go of right after. Either way
+// the timer still has to see the list when it runs, and nothing can be left
+// on the heap once they've all run or been cancelled.
+#define TIMER_LIST_EVERY 16
+
+struct timer_check {
+	struct timer_wheel *wheel;
+	long ran, late, batches, wrong;
+};
+
+// Make sure every timer runs on exactly the tick it was scheduled for
+void check_timers(struct script_timer **timers, int count, void *context) {
+	struct timer_check *check = (struct timer_check*)context;
+	check->batches++;
+	for(int i=0; i<count; i++) {
+		struct script_timer *timer = timers[i];
+		if(timer->expires != check->wheel->now || timer->args[0].integer != (long)timer->expires)
+			check->late++;
+		if(timer->arg_count > 3) {
+			struct script_list *list = (struct script_list*)timer->args[3].pointer;
+			if(timer->args[3].type != VALUE_LIST || list->refcount == REGION_OWNED
+				|| list->count != 1 || list->items[0].integer != (long)timer->expires)
+				check->wrong++;
+		}
+	}
+	check->ran += count;
+}
+
+// A list holding when the timer should run
+struct script_value timer_list(struct region *region, unsigned long expires) {
+	struct script_list *list = list_new(region, 1);
+	list_push(region, list, integer_value((long)expires));
+	return pointer_value(VALUE_LIST, list);
+}
+
+void bench_timers(long count, unsigned long max_delay, uint64_t seed) {
+	struct timer_wheel wheel;
+	struct timer_check check = {&wheel, 0, 0, 0, 0};
+	struct region region;
+	unsigned int *ids = (unsigned int*)malloc(count * sizeof(unsigned int));
+	random_state = seed ? seed : 1;
+	long heap_before = heap_counters.allocations - heap_counters.frees;
+
+	// the clock is fake: it's just the tick number passed to timer_advance
+	timer_wheel_init(&wheel, 0);
+	region_init(&region);
+
+	double start = bench_now();
+	for(long i=0; i<count; i++) {
+		unsigned long delay = 1 + random_next() % max_delay;
+		// bomb_explode style arguments, the first one records when it should run
+		struct script_value args[4] = {
+			{VALUE_INTEGER, {.integer = (long)(wheel.now + delay)}},
+			{VALUE_INTEGER, {.integer = i & 255}},
+			{VALUE_INTEGER, {.integer = i >> 8}},
+		};
+		if(i % TIMER_LIST_EVERY) {
+			ids[i] = timer_add(&wheel, delay, NULL, 0, 3, args);
+		} else {
+			int in_region = i % (TIMER_LIST_EVERY * 2) == 0;
+			region_reset(&region); // a new hook
+			args[3] = timer_list(in_region ? &region : NULL, wheel.now + delay);
+			ids[i] = timer_add(&wheel, delay, NULL, 0, 4, args);
+			// the hook's locals go away, and the next hook's take their place
+			value_release(args[3]);
+			region_reset(&region);
+			timer_list(&region, 0);
+		}
+		if(!ids[i])
+			break;
+	}
+	double added = bench_now();
+
+	long cancelled = 0;
+	for(long i=0; i<count; i+=10)
+		cancelled += timer_cancel(&wheel, ids[i]);
+	double cancelled_time = bench_now();
+
+	timer_advance(&wheel, max_delay + 1, check_timers, &check);
+	double finished = bench_now();
+	long left = wheel.pending;
+
+	// timers still waiting when the wheel goes away let go of their lists too
+	for(long i=0; i<TIMER_LIST_EVERY; i++) {
+		struct script_value args[1] = {timer_list(NULL, 0)};
+		timer_add(&wheel, 1 + i, NULL, 0, 1, args);
+		value_release(args[0]);
+	}
+	timer_wheel_free(&wheel);
+	region_free(&region);
+	long leaked = heap_counters.allocations - heap_counters.frees - heap_before;
+
+	printf("{\"bench\": \"timers\", \"seed\": %llu, \"timers\": %ld, \"max_delay\": %lu, "
+		"\"add_ns\": %.1f, \"cancel_ns\": %.1f, \"expire_ns\": %.1f, "
+		"\"ran\": %ld, \"cancelled\": %ld, \"late\": %ld, \"left\": %ld, \"batches\": %ld, "
+		"\"wrong\": %ld, \"leaked\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, count, max_delay,
+		(added - start) / count, cancelled ? (cancelled_time - added) / cancelled : 0.0,
+		check.ran ? (finished - cancelled_time) / check.ran : 0.0,
+		check.ran, cancelled, check.late, left, check.batches, check.wrong, leaked, peak_rss_kb());
+
+	free(ids);
+}
+
+// ----- HOOKS -----
+// Registers a few scripts' export tables and fires events at the registry,
+// checking each one calls exactly the right handlers in registration order:
+// keyed use item hooks only run for their own key, HOOK_NO_KEY runs every
+// handler for the event, and unknown keys and events run nothing. Replacing
+// a script's hooks has to keep its place. Then it times firing keyed events
+// with many scripts loaded.
+
+#define HOOK_LOG_SIZE 16
+#define BENCH_SCRIPTS 1000
+#define BENCH_ITEMS   100
+
+struct hook_log {
+	int count;
+	void *scripts[HOOK_LOG_SIZE];
+	int functions[HOOK_LOG_SIZE];
+};
+
+void log_hook(void *script, int function, void *context) {
+	struct hook_log *log = (struct hook_log*)context;
+	if(log->count < HOOK_LOG_SIZE) {
+		log->scripts[log->count] = script;
+		log->functions[log->count] = function;
+	}
+	log->count++;
+}
+
+void count_hook(void *script, int function, void *context) {
+	(void)script;
+	(*(long*)context) += function;
+}
+
+// Fire an event and compare what ran with the expected script/function pairs, ended by a NULL script
+long expect_fire(struct hook_registry *registry, int event, int key, void **scripts, const int *functions) {
+	struct hook_log log = {0};
+	int ran = hook_fire(registry, event, key, log_hook, &log);
+	int expected = 0;
+	while(scripts[expected])
+		expected++;
+	if(ran != expected || log.count != expected)
+		return 1;
+	for(int i=0; i<expected; i++)
+		if(log.scripts[i] != scripts[i] || log.functions[i] != functions[i])
+			return 1;
+	return 0;
+}
+
+void bench_hooks(long fires, uint64_t seed) {
+	struct hook_registry registry;
+	char script_a, script_b, script_c;
+	struct hook_export exports_a[] = {
+		{EVENT_PLACE_TILE, NULL, 0},
+		{EVENT_USE_ITEM, "bomb", 1},
+		{EVENT_USE_ITEM, "shovel", 2},
+	};
+	struct hook_export exports_b[] = {
+		{EVENT_USE_ITEM, "bomb", 5},
+		{EVENT_PLAYER_JOIN, NULL, 6},
+	};
+	struct hook_export exports_bad[] = {
+		{EVENT_GAME_START, NULL, 0},
+		{EVENT_COUNT, NULL, 1},
+	};
+	long wrong = 0;
+	hook_registry_init(&registry);
+	wrong += !hook_register_script(&registry, &script_a, exports_a, 3);
+	wrong += !hook_register_script(&registry, &script_b, exports_b, 2);
+	// a bad export table leaves none of its hooks behind
+	wrong += hook_register_script(&registry, &script_c, exports_bad, 2);
+
+	int bomb = hook_key(&registry, "bomb", 0), shovel = hook_key(&registry, "shovel", 0);
+	wrong += bomb <= 0 || shovel <= 0 || bomb == shovel || hook_key(&registry, "rake", 0) != -1;
+	{
+		void *scripts[] = {&script_a, &script_b, NULL};
+		int functions[] = {1, 5};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, bomb, scripts, functions);
+	}
+	{
+		void *scripts[] = {&script_a, NULL};
+		int functions[] = {2};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, shovel, scripts, functions);
+	}
+	{
+		void *scripts[] = {&script_a, &script_a, &script_b, NULL};
+		int functions[] = {1, 2, 5};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, HOOK_NO_KEY, scripts, functions);
+	}
+	{
+		void *scripts[] = {&script_a, NULL};
+		int functions[] = {0};
+		wrong += expect_fire(&registry, EVENT_PLACE_TILE, HOOK_NO_KEY, scripts, functions);
+	}
+	{
+		void *scripts[] = {NULL};
+		int functions[] = {0};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, -1, scripts, functions);
+		wrong += expect_fire(&registry, EVENT_GAME_START, HOOK_NO_KEY, scripts, functions);
+		wrong += expect_fire(&registry, EVENT_COUNT, HOOK_NO_KEY, scripts, functions);
+	}
+	// replacing a script's hooks keeps them ahead of the scripts registered after it,
+	// and a bad export table leaves the old ones there
+	struct hook_export reloaded_a[] = {
+		{EVENT_USE_ITEM, "bomb", 9},
+		{EVENT_GAME_START, NULL, 8},
+	};
+	wrong += !hook_replace_script(&registry, &script_a, reloaded_a, 2);
+	wrong += hook_replace_script(&registry, &script_a, exports_bad, 2);
+	{
+		void *scripts[] = {&script_a, &script_b, NULL};
+		int functions[] = {9, 5};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, HOOK_NO_KEY, scripts, functions);
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, bomb, scripts, functions);
+	}
+	{
+		void *scripts[] = {NULL};
+		int functions[] = {0};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, shovel, scripts, functions);
+	}
+	{
+		void *scripts[] = {&script_a, NULL};
+		int functions[] = {8};
+		wrong += expect_fire(&registry, EVENT_GAME_START, HOOK_NO_KEY, scripts, functions);
+	}
+	{
+		void *scripts[] = {NULL};
+		int functions[] = {0};
+		wrong += expect_fire(&registry, EVENT_PLACE_TILE, HOOK_NO_KEY, scripts, functions);
+	}
+	hook_unregister_script(&registry, &script_a);
+	{
+		void *scripts[] = {&script_b, NULL};
+		int functions[] = {5};
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, HOOK_NO_KEY, scripts, functions);
+		wrong += expect_fire(&registry, EVENT_USE_ITEM, bomb, scripts, functions);
+	}
+	hook_registry_free(&registry);
+
+	// lots of scripts, each with a hook for one of a hundred items
+	static char scripts[BENCH_SCRIPTS];
+	static char names[BENCH_ITEMS][16];
+	random_state = seed ? seed : 1;
+	hook_registry_init(&registry);
+	for(int i=0; i<BENCH_ITEMS; i++)
+		sprintf(names[i], "item%d", i);
+	for(int i=0; i<BENCH_SCRIPTS; i++) {
+		struct hook_export export = {EVENT_USE_ITEM, names[random_next() % BENCH_ITEMS], i};
+		hook_register_script(&registry, &scripts[i], &export, 1);
+	}
+	long ran = 0, sum = 0;
+	double start = bench_now();
+	for(long i=0; i<fires; i++)
+		ran += hook_fire(&registry, EVENT_USE_ITEM, hook_key(&registry, names[random_next() % BENCH_ITEMS], 0), count_hook, &sum);
+	double finished = bench_now();
+	hook_registry_free(&registry);
+
+	printf("{\"bench\": \"hooks\", \"seed\": %llu, \"scripts\": %d, \"fires\": %ld, \"handlers_run\": %ld, "
+		"\"fire_ns\": %.1f, \"wrong\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, BENCH_SCRIPTS, fires, ran, (finished - start) / fires, wrong, peak_rss_kb());
+}
+
+// ----- COMMAND BUFFER -----
+// A fake host with a small map. Every crossing into it rebuilds a summary
+// of the map, which stands in for the caches a real change invalidates.
+// bomb_explode from test.txt is run on it once calling the host directly
+// and once through a command buffer, and both have to end up with the same
+// world. Separately, commands are recorded with strings from a region that
+// gets reset and reused before they're flushed, and the host still has to
+// see the right text, with nothing left on the heap afterward.
+
+#define BENCH_MAP_SIZE 64
+#define BENCH_PLAYERS  32
+#define BENCH_LOBBY    32
+
+struct fake_world {
+	unsigned char objects[BENCH_MAP_SIZE][BENCH_MAP_SIZE];
+	int player_x[BENCH_PLAYERS], player_y[BENCH_PLAYERS];
+	unsigned long summary;
+	long crossings, queries;
+};
+
+void world_crossing(struct fake_world *world) {
+	unsigned long summary = 0;
+	for(int y=0; y<BENCH_MAP_SIZE; y++)
+		for(int x=0; x<BENCH_MAP_SIZE; x++)
+			summary = summary * 31 + world->objects[y][x];
+	world->summary = summary;
+	world->crossings++;
+}
+
+void world_apply(struct host_command *commands, int count, void *context) {
+	struct fake_world *world = (struct fake_world*)context;
+	for(int i=0; i<count; i++) {
+		struct host_command *command = &commands[i];
+		int x = (int)command->args[0].integer & (BENCH_MAP_SIZE-1);
+		int y = (int)command->args[1].integer & (BENCH_MAP_SIZE-1);
+		switch(command->kind) {
+			case COMMAND_OBJ_ADD:
+				world->objects[y][x]++;
+				break;
+			case COMMAND_OBJ_REMOVE:
+				if(world->objects[y][x])
+					world->objects[y][x]--;
+				break;
+			case COMMAND_PLAYER_MOVE: // player, x, y
+				world->player_x[command->args[0].integer] = (int)command->args[1].integer;
+				world->player_y[command->args[0].integer] = (int)command->args[2].integer;
+				break;
+		}
+	}
+	world_crossing(world);
+}
+
+// @player_at_xy, which is a host crossing either way
+int world_player_at_xy(struct fake_world *world, int x, int y, int *found) {
+	int count = 0;
+	for(int i=0; i<BENCH_PLAYERS; i++)
+		if(world->player_x[i] == x && world->player_y[i] == y)
+			found[count++] = i;
+	world->queries++;
+	world_crossing(world);
+	return count;
+}
+
+// A mutating builtin, through the buffer if there is one
+void world_command(struct fake_world *world, struct command_buffer *buffer, int kind, long a, long b, long c) {
+	struct script_value args[COMMAND_MAX_ARGS] = {
+		{VALUE_INTEGER, {.integer = a}},
+		{VALUE_INTEGER, {.integer = b}},
+		{VALUE_INTEGER, {.integer = c}},
+	};
+	if(buffer) {
+		command_record(buffer, kind, args);
+	} else {
+		struct host_command command = {kind};
+		memcpy(command.args, args, sizeof(args));
+		world_apply(&command, 1, world);
+	}
+}
+
+void world_kill(struct fake_world *world, struct command_buffer *buffer, int x, int y) {
+	int found[BENCH_PLAYERS];
+	if(buffer)
+		COMMAND_BEFORE_QUERY(buffer, WORLD_PLAYERS);
+	int count = world_player_at_xy(world, x & (BENCH_MAP_SIZE-1), y & (BENCH_MAP_SIZE-1), found);
+	for(int i=0; i<count; i++)
+		world_command(world, buffer, COMMAND_PLAYER_MOVE, found[i], BENCH_LOBBY, BENCH_LOBBY);
+}
+
+void world_bomb_explode(struct fake_world *world, struct command_buffer *buffer, int x, int y) {
+	world_command(world, buffer, COMMAND_OBJ_REMOVE, x, y, 0);
+	for(int n=x-2; n<=x+2; n++) {
+		world_command(world, buffer, COMMAND_OBJ_ADD, n, y, 0);
+		world_kill(world, buffer, n, y);
+		world_command(world, buffer, COMMAND_OBJ_ADD, x, n, 0);
+		world_kill(world, buffer, x, n);
+	}
+	if(buffer)
+		command_flush(buffer); // end of the hook
+}
+
+// Runs the explosions and returns how long they took
+double run_explosions(struct fake_world *world, struct command_buffer *buffer, long hooks, uint64_t seed) {
+	random_state = seed ? seed : 1;
+	memset(world, 0, sizeof(struct fake_world));
+	for(int i=0; i<BENCH_PLAYERS; i++) {
+		world->player_x[i] = random_next() % BENCH_MAP_SIZE;
+		world->player_y[i] = random_next() % BENCH_MAP_SIZE;
+	}
+
+	double start = bench_now();
+	for(long i=0; i<hooks; i++) {
+		// some land next to the lobby, so killed players get queried again
+		int x = (i & 7) ? random_next() % BENCH_MAP_SIZE : BENCH_LOBBY + (int)(random_next() % 5) - 2;
+		int y = (i & 7) ? random_next() % BENCH_MAP_SIZE : BENCH_LOBBY + (int)(random_next() % 5) - 2;
+		world_bomb_explode(world, buffer, x, y);
+	}
+	return bench_now() - start;
+}
+
+// @tile_put(x, y, tile) with the tile name from the region
+void tile_apply(struct host_command *commands, int count, void *context) {
+	char *tile = (char*)context;
+	for(int i=0; i<count; i++)
+		if(commands[i].kind == COMMAND_TILE_PUT && commands[i].args[2].type == VALUE_STRING)
+			snprintf(tile, 32, "%s", ((struct script_string*)commands[i].args[2].pointer)->text);
+}
+
+void check_region_args(long *wrong, long *leaked) {
+	struct region region;
+	struct command_buffer buffer;
+	char tile[32], expected[32];
+	long heap_before = heap_counters.allocations - heap_counters.frees;
+	region_init(&region);
+	command_buffer_init(&buffer, tile_apply, tile);
+
+	for(int i=0; i<64; i++) {
+		region_reset(&region); // a new hook
+		snprintf(expected, sizeof(expected), "tile_%d", i);
+		struct script_value args[COMMAND_MAX_ARGS] = {
+			integer_value(i), integer_value(i),
+			pointer_value(VALUE_STRING, string_new(&region, expected, (int)strlen(expected))),
+		};
+		command_record(&buffer, COMMAND_TILE_PUT, args);
+		// the hook returns, and the next one's region values go where this one's were
+		region_reset(&region);
+		string_new(&region, "overwritten_tile", 16);
+		if(i & 1) {
+			command_discard(&buffer);
+			continue;
+		}
+		tile[0] = 0;
+		command_flush(&buffer);
+		if(strcmp(tile, expected))
+			(*wrong)++;
+	}
+
+	command_buffer_free(&buffer);
+	region_free(&region);
+	*leaked = heap_counters.allocations - heap_counters.frees - heap_before;
+}
+
+void bench_command_buffer(long hooks, uint64_t seed) {
+	static struct fake_world direct, buffered;
+	struct command_buffer buffer;
+	long wrong = 0, leaked = 0;
+
+	double direct_time = run_explosions(&direct, NULL, hooks, seed);
+	command_buffer_init(&buffer, world_apply, &buffered);
+	double buffered_time = run_explosions(&buffered, &buffer, hooks, seed);
+
+	int same = !memcmp(direct.objects, buffered.objects, sizeof(direct.objects))
+		&& !memcmp(direct.player_x, buffered.player_x, sizeof(direct.player_x))
+		&& !memcmp(direct.player_y, buffered.player_y, sizeof(direct.player_y));
+
+	check_region_args(&wrong, &leaked);
+
+	long mutations = direct.crossings - direct.queries;
+	printf("{\"bench\": \"cmdbuf\", \"seed\": %llu, \"hooks\": %ld, \"commands\": %ld, \"queries\": %ld, "
+		"\"crossings_direct\": %ld, \"crossings_buffered\": %ld, \"flushes\": %ld, "
+		"\"hook_ns_direct\": %.1f, \"hook_ns_buffered\": %.1f, \"same_world\": %d, \"wrong\": %ld, \"leaked\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, hooks, mutations, direct.queries,
+		direct.crossings, buffered.crossings, buffer.crossings,
+		direct_time / hooks, buffered_time / hooks, same, wrong, leaked, peak_rss_kb());
+
+	command_buffer_free(&buffer);
+}
+
+// ----- HOT RELOAD -----
+// Reloads a made up script through a fixed sequence of edits, keeping its
+// globals and pending timers, and checks that every global and timer still
+// belongs to the same name afterward. The same edits are done with a full
+// unload and load to compare against. Each global holds a list that
+// remembers which global it was made for and how many ticks it has seen,
+// so a value that got lost or moved to the wrong slot is caught. The lists
+// and the timers also hold function values, which have to keep naming the
+// same function when the functions get reordered, or become none when
+// theirs goes away. Other scripts' hooks are registered before and after
+// the reloaded one's, and it has to stay second. Everything is a real heap list,
+// so globals the reload drops not getting released shows up as a leak.
+
+// Slots in each global's list
+enum {
+	GLOBAL_NAME,          // number of the global's name
+	GLOBAL_CREATED,       // tick it was made on
+	GLOBAL_TICKS,         // ticks it has seen
+	GLOBAL_FUNCTION,      // a function value
+	GLOBAL_FUNCTION_NAME, // number of that function's name
+	GLOBAL_SLOTS
+};
+
+struct reload_check {
+	long now;
+	long failed;
+};
+
+// Names are "name_n"
+long name_number(const char *name) {
+	return atol(name + 5);
+}
+
+void bench_init_global(struct script_module *module, int global, void *context) {
+	struct reload_check *check = (struct reload_check*)context;
+	struct script_image *image = module->image;
+	int function = global % image->function_count;
+	struct script_list *list = list_new(NULL, GLOBAL_SLOTS);
+	struct script_value function_value = {VALUE_FUNCTION, {.integer = function}};
+	list_push(NULL, list, integer_value(name_number(image->global_names[global])));
+	list_push(NULL, list, integer_value(check->now));
+	list_push(NULL, list, integer_value(check->now));
+	list_push(NULL, list, function_value);
+	list_push(NULL, list, integer_value(name_number(image->function_names[function])));
+	module->globals[global] = pointer_value(VALUE_LIST, list);
+}
+
+// One tick of the script running: every global gets touched
+void bench_tick(struct script_module *module, struct reload_check *check) {
+	check->now++;
+	for(int i=0; i<module->image->global_count; i++)
+		((struct script_list*)module->globals[i].pointer)->items[GLOBAL_TICKS].integer++;
+}
+
+// Make sure each global is the one for its name and has seen every tick since
+// it was made, and its function value names the same function it did.
+// live[n] is set if "name_n" is still a function
+void check_globals(struct script_module *module, struct reload_check *check, const char *live) {
+	struct script_image *image = module->image;
+	for(int i=0; i<image->global_count; i++) {
+		struct script_list *list = (struct script_list*)module->globals[i].pointer;
+		struct script_value function = list->items[GLOBAL_FUNCTION];
+		long function_name = list->items[GLOBAL_FUNCTION_NAME].integer;
+		if(module->globals[i].type != VALUE_LIST || list->items[GLOBAL_NAME].integer != name_number(image->global_names[i])
+		|| list->items[GLOBAL_TICKS].integer != check->now)
+			check->failed++;
+		else if(function.type == VALUE_FUNCTION ? function.integer >= image->function_count
+			|| name_number(image->function_names[function.integer]) != function_name
+			: function.type != VALUE_NONE || live[function_name])
+			check->failed++;
+	}
+}
+
+// Count globals that were there from the start but got made again.
+// The first original_count names are the originals
+long count_lost(struct script_module *module, int original_count) {
+	long lost = 0;
+	for(int i=0; i<module->image->global_count; i++) {
+		struct script_list *list = (struct script_list*)module->globals[i].pointer;
+		if(list->items[GLOBAL_CREATED].integer && list->items[GLOBAL_NAME].integer < original_count)
+			lost++;
+	}
+	return lost;
+}
+
+// Timers carry their function's name number and a function value for it, so both can be checked after a remap
+void check_reload_timers(struct timer_wheel *wheel, struct script_module *module, struct reload_check *check, long expected) {
+	long found = 0;
+	for(int chunk=0; chunk<wheel->chunk_count; chunk++) {
+		for(int i=0; i<TIMER_CHUNK_SIZE; i++) {
+			struct script_timer *timer = &wheel->chunks[chunk][i];
+			if(timer->state != TIMER_PENDING || timer->script != module)
+				continue;
+			found++;
+			if(timer->function >= module->image->function_count
+			|| name_number(module->image->function_names[timer->function]) != timer->args[0].integer
+			|| timer->args[1].type != VALUE_FUNCTION || timer->args[1].integer != timer->function)
+				check->failed++;
+		}
+	}
+	if(found != expected)
+		check->failed++;
+}
+
+// Where the script is in the order the join event's handlers run
+struct hook_order {
+	void *script;
+	int position, found;
+};
+
+void find_hook_position(void *script, int function, void *context) {
+	(void)function;
+	struct hook_order *order = (struct hook_order*)context;
+	if(script == order->script)
+		order->found = order->position;
+	order->position++;
+}
+
+// The edit sequence, applied to lists of names in place
+void edit_names(const char **globals, int *global_count, const char **functions, int *function_count,
+	int edit, const char **pool, int *next_name) {
+	switch(edit % 5) {
+		case 0: // add a global at the top, so every slot moves
+			memmove(&globals[1], &globals[0], *global_count * sizeof(const char*));
+			globals[0] = pool[(*next_name)++];
+			(*global_count)++;
+			break;
+		case 1: // remove one from the middle
+			memmove(&globals[*global_count/2], &globals[*global_count/2 + 1], (*global_count - *global_count/2 - 1) * sizeof(const char*));
+			(*global_count)--;
+			break;
+		case 2: // rename a function, so its timers go away
+			functions[*function_count - 1] = pool[(*next_name)++];
+			break;
+		case 3: // reorder the functions
+			for(int i=0; i<*function_count/2; i++) {
+				const char *swap = functions[i];
+				functions[i] = functions[*function_count - 1 - i];
+				functions[*function_count - 1 - i] = swap;
+			}
+			break;
+		case 4: // only a function body changed
+			break;
+	}
+}
+
+// Every version of the script has a join hook
+struct hook_export bench_exports[] = {
+	{EVENT_PLAYER_JOIN, NULL, 0},
+};
+
+struct script_image *copy_image(const char **globals, int global_count, const char **functions, int function_count) {
+	struct script_image *image = (struct script_image*)calloc(1, sizeof(struct script_image));
+	image->global_names = (const char**)malloc((global_count + 1) * sizeof(const char*));
+	image->function_names = (const char**)malloc((function_count + 1) * sizeof(const char*));
+	memcpy(image->global_names, globals, global_count * sizeof(const char*));
+	memcpy(image->function_names, functions, function_count * sizeof(const char*));
+	image->global_count = global_count;
+	image->function_count = function_count;
+	image->exports = bench_exports;
+	image->export_count = 1;
+	return image;
+}
+
+void free_image(struct script_image *image) {
+	free(image->global_names);
+	free(image->function_names);
+	free(image);
+}
+
+void bench_reload(long timers, int edits, uint64_t seed) {
+	const int globals_start = 2000, functions_start = 200;
+	int pool_size = globals_start + functions_start + edits + 1;
+	char **pool_text = (char**)malloc(pool_size * sizeof(char*));
+	const char **pool = (const char**)pool_text;
+	for(int i=0; i<pool_size; i++) {
+		pool_text[i] = (char*)malloc(24);
+		sprintf(pool_text[i], "name_%d", i);
+	}
+	const char **globals = (const char**)malloc((globals_start + edits + 1) * sizeof(const char*));
+	const char **functions = (const char**)malloc((functions_start + 1) * sizeof(const char*));
+	char *live = (char*)calloc(pool_size, 1);
+	int global_count = globals_start, function_count = functions_start, next_name = 0;
+	for(int i=0; i<global_count; i++)
+		globals[i] = pool[next_name++];
+	for(int i=0; i<function_count; i++)
+		functions[i] = pool[next_name++];
+
+	struct hook_registry registry;
+	struct timer_wheel wheel;
+	struct script_module hot, full;
+	struct reload_check check = {0, 0}, full_check = {0, 0};
+	struct script_image **images = (struct script_image**)calloc(edits + 1, sizeof(struct script_image*));
+	char first_script, last_script;
+	memset(&heap_counters, 0, sizeof(heap_counters));
+	hook_registry_init(&registry);
+	timer_wheel_init(&wheel, 0);
+	random_state = seed ? seed : 1;
+
+	images[0] = copy_image(globals, global_count, functions, function_count);
+	hook_register_script(&registry, &first_script, bench_exports, 1);
+	module_load(&hot, images[0], &registry, bench_init_global, &check);
+	hook_register_script(&registry, &last_script, bench_exports, 1);
+	module_load(&full, images[0], &registry, bench_init_global, &full_check);
+	for(long i=0; i<timers; i++) {
+		int function = random_next() % function_count;
+		unsigned long delay = 1 + random_next() % 100000;
+		struct script_value args[2] = {
+			{VALUE_INTEGER, {.integer = name_number(functions[function])}},
+			{VALUE_FUNCTION, {.integer = function}},
+		};
+		timer_add(&wheel, delay, &hot, function, 2, args);
+		timer_add(&wheel, delay, &full, function, 2, args);
+	}
+	long expected_timers = timers;
+
+	double prepare_time = 0, commit_time = 0, full_time = 0;
+	for(int edit=0; edit<edits; edit++) {
+		bench_tick(&hot, &check);
+		bench_tick(&full, &full_check);
+
+		// timers for a function that's about to be renamed are expected to go
+		if(edit % 5 == 2) {
+			for(int chunk=0; chunk<wheel.chunk_count; chunk++)
+				for(int i=0; i<TIMER_CHUNK_SIZE; i++)
+					if(wheel.chunks[chunk][i].state == TIMER_PENDING && wheel.chunks[chunk][i].script == &hot
+					&& wheel.chunks[chunk][i].function == function_count - 1)
+						expected_timers--;
+		}
+		edit_names(globals, &global_count, functions, &function_count, edit, pool, &next_name);
+		struct script_image *image = images[edit+1] = copy_image(globals, global_count, functions, function_count);
+		memset(live, 0, pool_size);
+		for(int i=0; i<function_count; i++)
+			live[name_number(functions[i])] = 1;
+
+		// hot: globals that got dropped are released by the commit
+		struct reload_plan plan;
+		double start = bench_now();
+		reload_prepare(&plan, &hot, image);
+		double prepared = bench_now();
+		if(!reload_commit(&plan, &registry, &wheel, bench_init_global, &check))
+			check.failed++;
+		double committed = bench_now();
+		prepare_time += prepared - start;
+		commit_time += committed - prepared;
+
+		// full: everything starts over, and the timers are lost
+		start = bench_now();
+		module_unload(&full, &registry, &wheel);
+		module_load(&full, image, &registry, bench_init_global, &full_check);
+		full_time += bench_now() - start;
+
+		check_globals(&hot, &check, live);
+		check_reload_timers(&wheel, &hot, &check, expected_timers);
+		struct hook_order order = {&hot, 0, -1};
+		hook_fire(&registry, EVENT_PLAYER_JOIN, HOOK_NO_KEY, find_hook_position, &order);
+		if(order.found != 1)
+			check.failed++;
+	}
+	long lost = count_lost(&hot, globals_start);
+	long full_lost = count_lost(&full, globals_start);
+	long timers_left = wheel.pending;
+
+	module_unload(&hot, &registry, &wheel);
+	module_unload(&full, &registry, &wheel);
+	long leaked = heap_counters.allocations - heap_counters.frees;
+
+	printf("{\"bench\": \"reload\", \"seed\": %llu, \"edits\": %d, \"globals\": %d, \"functions\": %d, \"timers\": %ld, "
+		"\"timers_left\": %ld, \"prepare_ns\": %.1f, \"commit_ns\": %.1f, \"full_reload_ns\": %.1f, "
+		"\"failed\": %ld, \"globals_lost\": %ld, \"full_reload_globals_lost\": %ld, \"leaked\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, edits, global_count, function_count, timers,
+		timers_left, prepare_time / edits, commit_time / edits, full_time / edits,
+		check.failed, lost, full_lost, leaked, peak_rss_kb());
+
+	for(int i=0; i<=edits; i++)
+		free_image(images[i]);
+	free(images);
+	for(int i=0; i<pool_size; i++)
+		free(pool_text[i]);
+	free(pool_text);
+	free(globals);
+	free(functions);
+	free(live);
+	timer_wheel_free(&wheel);
+	hook_registry_free(&registry);
+}
+
+// ----- REGIONS -----
+// bomb_explode from test.txt, with kill and check_for_winner inlined into
+// it, allocating the way the escape analysis says: the list of tiles and the
+// [n, y] pairs in it go to @timer so they're on the heap, and the
+// @player_at_xy results and the strings for the winner announcement go in
+// the region. The baseline puts everything on the heap.
+//
+// Separately, a region list holds a global's heap list while the global is
+// reassigned, like "var l = [g]; g = 0; @say(l[0])", and l[0] still has to
+// be there until the hook ends.
+
+// Makes a new string from two, like + does
+struct script_string *string_join(struct region *region, const char *a, struct script_string *b) {
+	char text[256];
+	int length = snprintf(text, sizeof(text), "%s%s", a, b->text);
+	return string_new(region, text, length < (int)sizeof(text) ? length : (int)sizeof(text) - 1);
+}
+
+// region is NULL to put everything on the heap
+void region_explosion(struct region *region, int x, int y) {
+	// var list = []
+	struct script_list *list = list_new(NULL, 0);
+
+	for(int n=x-2; n<=x+2; n++) {
+		for(int direction=0; direction<2; direction++) {
+			// @push(list, [n, y])
+			struct script_list *pair = list_new(NULL, 2);
+			list_push(NULL, pair, integer_value(direction ? x : n));
+			list_push(NULL, pair, integer_value(direction ? n : y));
+			list_push(NULL, list, pointer_value(VALUE_LIST, pair));
+			value_release(pointer_value(VALUE_LIST, pair));
+
+			// kill(): var list = @player_at_xy(x, y)
+			struct script_list *players = list_new(region, 0);
+			for(int i=0; i<(int)(random_next() % 3); i++)
+				list_push(region, players, integer_value(i));
+
+			// check_for_winner(): the announcement strings
+			if(random_next() % 4 == 0) {
+				struct script_string *name = string_new(region, "player", 6);
+				struct script_string *wins = string_new(region, "12", 2);
+				struct script_string *message = string_join(region, "the winner is ", name);
+				struct script_string *count = string_join(region, "their win count: ", wins);
+				if(!region) {
+					value_release(pointer_value(VALUE_STRING, name));
+					value_release(pointer_value(VALUE_STRING, wins));
+					value_release(pointer_value(VALUE_STRING, message));
+					value_release(pointer_value(VALUE_STRING, count));
+				}
+			}
+			if(!region)
+				value_release(pointer_value(VALUE_LIST, players));
+		}
+	}
+
+	// @timer(1, bomb_clean, list), then bomb_clean runs and lets go of it
+	value_release(pointer_value(VALUE_LIST, list));
+	if(region)
+		region_reset(region);
+}
+
+// Returns how many times l[0] was wrong
+long check_region_holds(struct region *region) {
+	long wrong = 0;
+	for(long i=0; i<64; i++) {
+		// g = [i]
+		struct script_list *global = list_new(NULL, 0);
+		list_push(NULL, global, integer_value(i));
+		// var l = [g]
+		struct script_list *local = list_new(region, 0);
+		list_push(region, local, pointer_value(VALUE_LIST, global));
+		// g = 0, and something else gets made where g's list was
+		value_release(pointer_value(VALUE_LIST, global));
+		struct script_list *other = list_new(NULL, 0);
+		list_push(NULL, other, integer_value(-1));
+		// @say(l[0])
+		struct script_list *held = (struct script_list*)local->items[0].pointer;
+		if(held->count != 1 || held->items[0].integer != i)
+			wrong++;
+		value_release(pointer_value(VALUE_LIST, other));
+		region_reset(region);
+	}
+	return wrong;
+}
+
+void bench_region(long events, uint64_t seed) {
+	struct region region;
+	region_init(&region);
+	long allocations[2], frees[2], blocks[2];
+	double times[2];
+
+	for(int mode=0; mode<2; mode++) {
+		struct region *use = mode ? &region : NULL;
+		random_state = seed ? seed : 1;
+		memset(&heap_counters, 0, sizeof(heap_counters));
+		double start = bench_now();
+		for(long i=0; i<events; i++)
+			region_explosion(use, random_next() % 64, random_next() % 64);
+		times[mode] = bench_now() - start;
+		allocations[mode] = heap_counters.allocations;
+		frees[mode] = heap_counters.frees;
+		blocks[mode] = region.block_allocations;
+	}
+
+	memset(&heap_counters, 0, sizeof(heap_counters));
+	long wrong = check_region_holds(&region);
+	long held_leaks = heap_counters.allocations - heap_counters.frees;
+
+	printf("{\"bench\": \"region\", \"seed\": %llu, \"events\": %ld, "
+		"\"heap_allocs_per_event\": %.2f, \"region_heap_allocs_per_event\": %.2f, \"region_blocks\": %ld, "
+		"\"event_ns_heap\": %.1f, \"event_ns_region\": %.1f, \"wrong\": %ld, \"leaked\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, events,
+		(double)allocations[0] / events, (double)allocations[1] / events, blocks[1],
+		times[0] / events, times[1] / events, wrong,
+		(allocations[0] - frees[0]) + (allocations[1] - frees[1]) + held_leaks, peak_rss_kb());
+
+	region_free(&region);
+}
+
+// ----- PROFILER -----
+// Runs a made up place_tile_hook -> bomb_explode -> kill call chain with
+// PROFILE_ENTER/LEAVE/POINT, forcing a sample at every point, then reads
+// the folded output back and checks each stack got exactly the samples it
+// should have. kill calls into a second script, which has to start a new
+// root frame in the output. Also times a sample point when no sample is
+// due, which is what scripts pay while the profiler is on.
+
+#define BENCH_LOOP 5    // times bomb_explode's loop goes around
+
+#ifdef TTR_PROFILE
+
+struct folded_stack {
+	const char *stack;
+	long expected, found;
+};
+
+// Reach a sample point, with the timer made to have fired first
+void forced_point(int line) {
+	profile_sample_due = 1;
+	PROFILE_POINT(line);
+}
+
+void profile_hook() {
+	PROFILE_ENTER("test.txt", "place_tile_hook", 0);
+	forced_point(5);
+	PROFILE_ENTER("test.txt", "bomb_explode", 8);
+	for(int i=0; i<BENCH_LOOP; i++)
+		forced_point(20);
+	PROFILE_ENTER("test.txt", "kill", 22);
+	forced_point(30);
+	PROFILE_ENTER("lib.txt", "announce", 31);
+	forced_point(2);
+	PROFILE_LEAVE();
+	PROFILE_LEAVE();
+	PROFILE_LEAVE();
+	PROFILE_LEAVE();
+}
+
+void bench_profile(long hooks) {
+	struct folded_stack stacks[] = {
+		{"test.txt;place_tile_hook:5", hooks, 0},
+		{"test.txt;place_tile_hook:8;bomb_explode:20", hooks * BENCH_LOOP, 0},
+		{"test.txt;place_tile_hook:8;bomb_explode:22;kill:30", hooks, 0},
+		{"test.txt;place_tile_hook:8;bomb_explode:22;kill:31;lib.txt;announce:2", hooks, 0},
+		{NULL},
+	};
+	profile_clear();
+
+	double start = bench_now();
+	for(long i=0; i<hooks; i++)
+		profile_hook();
+	double sampled = bench_now();
+
+	// the usual case, nothing due
+	profile_sample_due = 0;
+	PROFILE_ENTER("test.txt", "place_tile_hook", 0);
+	for(long i=0; i<hooks * 100; i++)
+		PROFILE_POINT(5);
+	PROFILE_LEAVE();
+	double idle = bench_now();
+
+	FILE *folded = tmpfile();
+	if(!folded) {
+		puts("Can't make a temporary file");
+		return;
+	}
+	profile_write_folded(folded);
+	rewind(folded);
+
+	long wrong = 0, lines = 0;
+	char line[512];
+	while(fgets(line, sizeof(line), folded)) {
+		char *space = strrchr(line, ' ');
+		lines++;
+		if(!space) {
+			wrong++;
+			continue;
+		}
+		*space = 0;
+		int i;
+		for(i=0; stacks[i].stack; i++)
+			if(!strcmp(stacks[i].stack, line))
+				break;
+		if(stacks[i].stack)
+			stacks[i].found += atol(space + 1);
+		else
+			wrong++; // a stack that shouldn't be there
+	}
+	for(int i=0; stacks[i].stack; i++)
+		if(stacks[i].found != stacks[i].expected)
+			wrong++;
+	fclose(folded);
+	profile_clear();
+
+	long samples = hooks * (BENCH_LOOP + 3);
+	printf("{\"bench\": \"profile\", \"hooks\": %ld, \"samples\": %ld, \"stacks\": %ld, "
+		"\"sample_ns\": %.1f, \"idle_point_ns\": %.2f, \"wrong\": %ld, \"peak_rss_kb\": %ld}\n",
+		hooks, samples, lines, (sampled - start) / samples, (idle - sampled) / (hooks * 100),
+		wrong, peak_rss_kb());
+}
+#else
+void bench_profile(long hooks) {
+	puts("{\"bench\": \"profile\", \"error\": \"built without TTR_PROFILE\"}");
+}
+#endif
+
+// ----- FUEL -----
+// Runs hooks that loop forever with FUEL_CHECK at the back edge, the way a
+// script stuck in a while loop would. With FUEL_ABORT each one has to come
+// back to where the invocation started, through the longjmp, after exactly
+// the number of checks its budget pays for and with nothing left in the
+// tank. FUEL_YIELD has to stop at the same point without jumping.
+// fuel_prepay() is checked against budgets it does and doesn't fit in.
+
+struct fuel_check {
+	long checks;    // FUEL_CHECKs done, over every invocation
+	long wrong;
+};
+
+// Loop until the fuel runs out, counting the times it went around
+void fuel_loop(struct fuel_tank *tank, long steps, volatile long *loops) {
+	while(!tank->empty) {
+		(*loops)++;
+		FUEL_CHECK(tank, steps);
+	}
+}
+
+void fuel_invocation(struct fuel_check *check, long budget, long steps, int policy) {
+	struct fuel_tank tank;
+	jmp_buf abort_to;
+	volatile long loops = 0;
+	// the check that takes it below zero is the one that stops it
+	long expected = budget / steps + 1;
+
+	fuel_fill(&tank, budget, policy, &abort_to);
+	if(!setjmp(abort_to)) {
+		fuel_loop(&tank, steps, &loops);
+		if(policy == FUEL_ABORT)
+			check->wrong++; // should have jumped
+	} else if(policy != FUEL_ABORT) {
+		check->wrong++;
+	}
+	if(loops != expected || tank.remaining != 0 || !tank.empty)
+		check->wrong++;
+	check->checks += loops;
+}
+
+void check_prepay(struct fuel_check *check, long budget) {
+	struct fuel_tank tank;
+	fuel_fill(&tank, budget, FUEL_ABORT, NULL);
+	if(!fuel_prepay(&tank, budget / 2) || tank.remaining != budget - budget / 2)
+		check->wrong++;
+	// doesn't fit in what's left now, and unbounded functions never do
+	if(fuel_prepay(&tank, budget) || fuel_prepay(&tank, -1) || tank.remaining != budget - budget / 2 || tank.empty)
+		check->wrong++;
+	if(!fuel_prepay(&tank, tank.remaining) || tank.remaining != 0)
+		check->wrong++;
+}
+
+void bench_fuel(long invocations, uint64_t seed) {
+	struct fuel_check aborts = {0, 0}, yields = {0, 0};
+	random_state = seed ? seed : 1;
+
+	double start = bench_now();
+	for(long i=0; i<invocations; i++)
+		fuel_invocation(&aborts, 1000 + random_next() % 1000, 1 + random_next() % 8, FUEL_ABORT);
+	double aborted = bench_now();
+
+	random_state = seed ? seed : 1;
+	for(long i=0; i<invocations; i++)
+		fuel_invocation(&yields, 1000 + random_next() % 1000, 1 + random_next() % 8, FUEL_YIELD);
+	double yielded = bench_now();
+
+	for(long i=0; i<invocations; i++)
+		check_prepay(&aborts, random_next() % 100000);
+
+	printf("{\"bench\": \"fuel\", \"seed\": %llu, \"invocations\": %ld, \"checks\": %ld, "
+		"\"check_ns_abort\": %.2f, \"check_ns_yield\": %.2f, \"wrong\": %ld, \"peak_rss_kb\": %ld}\n",
+		(unsigned long long)seed, invocations, aborts.checks,
+		(aborted - start) / aborts.checks, (yielded - aborted) / yields.checks,
+		aborts.wrong + yields.wrong + (aborts.checks != yields.checks), peak_rss_kb());
+}
+
+// ----- MAIN -----
+
+void usage() {
+	puts("Usage: ttrbench [timers|hooks|cmdbuf|reload|region|profile|fuel] [--count n] [--delay ticks] [--seed n] [--edits n]");
+	puts("hooks fires count/100 events, cmdbuf runs count/100 hooks, reload keeps count/50 timers pending, region runs count/10 events,");
+	puts("profile and fuel run count/100 hooks");
+	exit(0);
+}
+
+int main(int argc, char *argv[]) {
+	const char *which = "all";
+	long count = 1000000;
+	unsigned long delay = 100000;
+	uint64_t seed = 1;
+	int edits = 100;
+
+	for(int i=1; i<argc; i++) {
+		if(!strcmp(argv[i], "--count") && i+1 < argc)
+			count = atol(argv[++i]);
+		else if(!strcmp(argv[i], "--delay") && i+1 < argc)
+			delay = strtoul(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "--seed") && i+1 < argc)
+			seed = strtoull(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "--edits") && i+1 < argc)
+			edits = atoi(argv[++i]);
+		else if(argv[i][0] != '-')
+			which = argv[i];
+		else
+			usage();
+	}
+	if(count < 1 || delay < 1 || edits < 1)
+		usage();
+
+	int found = 0;
+	if(!strcmp(which, "all") || !strcmp(which, "timers")) {
+		bench_timers(count, delay, seed);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "hooks")) {
+		bench_hooks(count / 100 ? count / 100 : 1, seed);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "cmdbuf")) {
+		bench_command_buffer(count / 100 ? count / 100 : 1, seed);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "reload")) {
+		bench_reload(count / 50, edits, seed);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "region")) {
+		bench_region(count / 10 ? count / 10 : 1, seed);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "profile")) {
+		bench_profile(count / 100 ? count / 100 : 1);
+		found = 1;
+	}
+	if(!strcmp(which, "all") || !strcmp(which, "fuel")) {
+		bench_fuel(count / 100 ? count / 100 : 1, seed);
+		found = 1;
+	}
+	if(!found)
+		usage();
+	return 0;
+}
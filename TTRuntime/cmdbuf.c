@@ -0,0 +1,116 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+// What each command_kind changes
+const int command_changes[] = {
+	WORLD_TILES,    // COMMAND_TILE_PUT
+	WORLD_OBJECTS,  // COMMAND_OBJ_ADD
+	WORLD_OBJECTS,  // COMMAND_OBJ_REMOVE
+	WORLD_PLAYERS,  // COMMAND_PLAYER_MOVE
+};
+
+// One buffer can be reused for every invocation; it keeps its memory
+void command_buffer_init(struct command_buffer *buffer, command_apply apply, void *context) {
+	memset(buffer, 0, sizeof(struct command_buffer));
+	buffer->apply = apply;
+	buffer->context = context;
+}
+
+// Recorded commands hold references to their arguments, and an argument in
+// the invocation's region is promoted to the heap first, since commands can
+// be applied after the region is reset. Returns 0 if there's no memory
+int command_keep(struct host_command *command, struct script_value *args) {
+	for(int i=0; i<COMMAND_MAX_ARGS; i++) {
+		command->args[i] = value_promote(args[i]);
+		if(command->args[i].type == VALUE_NONE && args[i].type != VALUE_NONE) {
+			while(i--)
+				value_release(command->args[i]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Drop the references commands took, once the host is done with them
+void command_release(struct host_command *commands, int count) {
+	for(int i=0; i<count; i++)
+		for(int j=0; j<COMMAND_MAX_ARGS; j++)
+			value_release(commands[i].args[j]);
+}
+
+void command_buffer_free(struct command_buffer *buffer) {
+	command_discard(buffer);
+	free(buffer->commands);
+	buffer->commands = NULL;
+	buffer->count = buffer->capacity = 0;
+}
+
+// Hand everything recorded so far to the host. Called at the end of every
+// hook, and before any builtin that reads the map. The host has to retain
+// any argument it wants to keep after apply returns
+void command_flush(struct command_buffer *buffer) {
+	if(!buffer->count)
+		return;
+	buffer->apply(buffer->commands, buffer->count, buffer->context);
+	command_release(buffer->commands, buffer->count);
+	buffer->crossings++;
+	buffer->applied += buffer->count;
+	buffer->count = 0;
+	buffer->pending = 0;
+}
+
+// Throw away what's recorded, for a hook whose changes shouldn't happen
+void command_discard(struct command_buffer *buffer) {
+	command_release(buffer->commands, buffer->count);
+	buffer->count = 0;
+	buffer->pending = 0;
+}
+
+// Record a builtin call that changes the map
+void command_record(struct command_buffer *buffer, int kind, struct script_value *args) {
+	if(buffer->count == COMMAND_BUFFER_LIMIT)
+		command_flush(buffer);
+
+	struct host_command *commands = buffer->commands;
+	if(buffer->count == buffer->capacity) {
+		int capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+		commands = (struct host_command*)realloc(buffer->commands, capacity * sizeof(struct host_command));
+		if(commands) {
+			buffer->commands = commands;
+			buffer->capacity = capacity;
+		}
+	}
+
+	struct host_command *command = commands ? &buffer->commands[buffer->count] : NULL;
+	if(!command || !command_keep(command, args)) {
+		// no room to put it off, so keep the order and do it now,
+		// while the arguments are still good
+		struct host_command now = {kind};
+		memcpy(now.args, args, sizeof(now.args));
+		command_flush(buffer);
+		buffer->apply(&now, 1, buffer->context);
+		buffer->crossings++;
+		buffer->applied++;
+		return;
+	}
+	command->kind = kind;
+	buffer->count++;
+	buffer->pending |= command_changes[kind];
+}
@@ -0,0 +1,35 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TT_EVENTS_H
+#define TT_EVENTS_H
+
+// Events the host can call a script for. The compiler writes these IDs into
+// each script's export table and the runtime keeps a handler list for each,
+// so both include this file.
+enum event_id {
+	EVENT_PLACE_TILE,
+	EVENT_PLAYER_JOIN,
+	EVENT_PLAYER_LEAVE,
+	EVENT_GAME_START,
+	EVENT_USE_ITEM,
+
+	EVENT_COUNT
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+// Give a hook invocation its budget before running it. A yielded hook
+// gets its tank filled again when it's resumed on a later tick.
+void fuel_fill(struct fuel_tank *tank, long budget, int policy, jmp_buf *abort_to) {
+	tank->remaining = budget;
+	tank->policy = policy;
+	tank->empty = 0;
+	tank->abort_to = abort_to;
+}
+
+// Pay for a whole function up front if its worst case fits in what's left.
+// Returns 1 if it was paid for and can run without fuel checks.
+// Pass a negative cost for functions the compiler couldn't put a bound on.
+int fuel_prepay(struct fuel_tank *tank, long worst_case_steps) {
+	if(worst_case_steps < 0 || worst_case_steps > tank->remaining)
+		return 0;
+	tank->remaining -= worst_case_steps;
+	return 1;
+}
+
+// Called by FUEL_CHECK when the budget has run out
+void fuel_empty(struct fuel_tank *tank) {
+	tank->empty = 1;
+	tank->remaining = 0;
+	if(tank->policy == FUEL_ABORT && tank->abort_to)
+		longjmp(*tank->abort_to, 1);
+}
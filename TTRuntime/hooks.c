@@ -0,0 +1,283 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+void hook_registry_init(struct hook_registry *registry) {
+	memset(registry, 0, sizeof(struct hook_registry));
+}
+
+void free_hook_list(struct hook_list *list) {
+	free(list->handlers);
+	free(list->by_key);
+	free(list->key_starts);
+	memset(list, 0, sizeof(struct hook_list));
+}
+
+void hook_registry_free(struct hook_registry *registry) {
+	for(int i=0; i<EVENT_COUNT; i++)
+		free_hook_list(&registry->events[i]);
+	for(int i=0; i<registry->key_count; i++)
+		free(registry->keys[i]);
+	free(registry->keys);
+	free(registry->key_table);
+	memset(registry, 0, sizeof(struct hook_registry));
+}
+
+// ----- KEYS -----
+
+unsigned int key_hash(const char *name) {
+	unsigned int hash = 2166136261u;
+	for(; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+// The slot a key is in, or the empty one it would go in
+int *key_slot(struct hook_registry *registry, const char *name) {
+	int mask = registry->key_table_size - 1;
+	for(int slot = key_hash(name) & mask; ; slot = (slot+1) & mask) {
+		int id = registry->key_table[slot];
+		if(!id || !strcmp(registry->keys[id-1], name))
+			return &registry->key_table[slot];
+	}
+}
+
+// Keep the table at most half full. Returns 0 if there's no memory
+int grow_key_table(struct hook_registry *registry) {
+	if((registry->key_count + 1) * 2 <= registry->key_table_size)
+		return 1;
+	int size = registry->key_table_size ? registry->key_table_size * 2 : 32;
+	int *table = (int*)calloc(size, sizeof(int));
+	if(!table)
+		return 0;
+	free(registry->key_table);
+	registry->key_table = table;
+	registry->key_table_size = size;
+	for(int i=0; i<registry->key_count; i++)
+		*key_slot(registry, registry->keys[i]) = i+1;
+	return 1;
+}
+
+// Gets the ID for a key like an item name, so firing an event compares
+// integers instead of strings. Returns -1 if it's not there and create is 0,
+// or if there's no memory for it
+int hook_key(struct hook_registry *registry, const char *name, int create) {
+	if(!name)
+		return HOOK_NO_KEY;
+	if(registry->key_table_size) {
+		int id = *key_slot(registry, name);
+		if(id)
+			return id;
+	}
+	if(!create || !grow_key_table(registry))
+		return -1;
+
+	if(registry->key_count == registry->key_capacity) {
+		int capacity = registry->key_capacity ? registry->key_capacity * 2 : 16;
+		char **keys = (char**)realloc(registry->keys, capacity * sizeof(char*));
+		if(!keys)
+			return -1;
+		registry->keys = keys;
+		registry->key_capacity = capacity;
+	}
+	char *copy = strdup(name);
+	if(!copy)
+		return -1;
+	registry->keys[registry->key_count++] = copy;
+	*key_slot(registry, copy) = registry->key_count;
+	return registry->key_count;
+}
+
+// ----- HANDLERS -----
+
+// Group a list's handlers by key, keeping their order within each key.
+// Only needs more memory if there are more handlers or bigger key IDs than
+// the last time, so it can't fail after handlers are taken out.
+// Returns 0 if there's no memory
+int index_handlers(struct hook_list *list) {
+	int slots = 1;
+	for(int i=0; i<list->count; i++)
+		if(list->handlers[i].key + 2 > slots)
+			slots = list->handlers[i].key + 2;
+	if(list->count > list->by_key_capacity) {
+		struct hook_handler *by_key = (struct hook_handler*)realloc(list->by_key, list->capacity * sizeof(struct hook_handler));
+		if(!by_key)
+			return 0;
+		list->by_key = by_key;
+		list->by_key_capacity = list->capacity;
+	}
+	if(slots > list->key_slots) {
+		int *key_starts = (int*)realloc(list->key_starts, slots * 2 * sizeof(int));
+		if(!key_starts)
+			return 0;
+		list->key_starts = key_starts;
+		list->key_slots = slots * 2;
+	}
+
+	// count each key, then each key's handlers start after all the ones before it
+	int *starts = list->key_starts;
+	memset(starts, 0, list->key_slots * sizeof(int));
+	for(int i=0; i<list->count; i++)
+		starts[list->handlers[i].key + 1]++;
+	for(int k=1; k<list->key_slots; k++)
+		starts[k] += starts[k-1];
+	// placing them moves each start to the end of its key, which is the next key's start
+	for(int i=0; i<list->count; i++)
+		list->by_key[starts[list->handlers[i].key]++] = list->handlers[i];
+	for(int k=list->key_slots-1; k>0; k--)
+		starts[k] = starts[k-1];
+	starts[0] = 0;
+	return 1;
+}
+
+int add_handler(struct hook_list *list, void *script, int function, int key) {
+	if(list->count == list->capacity) {
+		int capacity = list->capacity ? list->capacity * 2 : 8;
+		struct hook_handler *handlers = (struct hook_handler*)realloc(list->handlers, capacity * sizeof(struct hook_handler));
+		if(!handlers)
+			return 0;
+		list->handlers = handlers;
+		list->capacity = capacity;
+	}
+	struct hook_handler *handler = &list->handlers[list->count++];
+	handler->script = script;
+	handler->function = function;
+	handler->key = key;
+	return 1;
+}
+
+// Add every hook in a script's export table. Returns 0 and leaves none of
+// them registered if something goes wrong
+int hook_register_script(struct hook_registry *registry, void *script, struct hook_export *exports, int count) {
+	char changed[EVENT_COUNT];
+	memset(changed, 0, sizeof(changed));
+	for(int i=0; i<count; i++) {
+		struct hook_export *export = &exports[i];
+		int key = hook_key(registry, export->key, 1);
+		if(export->event < 0 || export->event >= EVENT_COUNT || key < 0
+		|| !add_handler(&registry->events[export->event], script, export->function, key)) {
+			hook_unregister_script(registry, script);
+			return 0;
+		}
+		changed[export->event] = 1;
+	}
+	for(int event=0; event<EVENT_COUNT; event++) {
+		if(changed[event] && !index_handlers(&registry->events[event])) {
+			hook_unregister_script(registry, script);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Make an event's new handler list for hook_replace_script: the script's new
+// handlers go where its first old one was, or at the end if it had none
+int replace_handlers(struct hook_list *new_list, struct hook_list *old, void *script,
+	struct hook_export *exports, int *keys, int count, int event) {
+	int placed = 0;
+	for(int i=0; i<=old->count; i++) {
+		if(!placed && (i == old->count || old->handlers[i].script == script)) {
+			for(int j=0; j<count; j++)
+				if(exports[j].event == event && !add_handler(new_list, script, exports[j].function, keys[j]))
+					return 0;
+			placed = 1;
+		}
+		if(i < old->count && old->handlers[i].script != script
+		&& !add_handler(new_list, old->handlers[i].script, old->handlers[i].function, old->handlers[i].key))
+			return 0;
+	}
+	return 1;
+}
+
+// Swap all of a script's handlers for a new export table, like a reload does.
+// Each event's handlers for the script stay where the old ones were, so it
+// keeps running in the same order relative to other scripts. Returns 0 and
+// leaves the old handlers registered if something goes wrong
+int hook_replace_script(struct hook_registry *registry, void *script, struct hook_export *exports, int count) {
+	struct hook_list lists[EVENT_COUNT];
+	char changes[EVENT_COUNT];
+	int *keys = (int*)malloc((count + 1) * sizeof(int));
+	int ok = keys != NULL;
+	memset(lists, 0, sizeof(lists));
+	memset(changes, 0, sizeof(changes));
+
+	for(int i=0; ok && i<count; i++) {
+		keys[i] = hook_key(registry, exports[i].key, 1);
+		if(exports[i].event < 0 || exports[i].event >= EVENT_COUNT || keys[i] < 0)
+			ok = 0;
+		else
+			changes[exports[i].event] = 1;
+	}
+	// events the script has nothing to do with are left alone
+	for(int event=0; ok && event<EVENT_COUNT; event++) {
+		struct hook_list *old = &registry->events[event];
+		for(int i=0; i<old->count && !changes[event]; i++)
+			if(old->handlers[i].script == script)
+				changes[event] = 1;
+		if(changes[event])
+			ok = replace_handlers(&lists[event], old, script, exports, keys, count, event)
+				&& index_handlers(&lists[event]);
+	}
+
+	for(int event=0; event<EVENT_COUNT; event++) {
+		if(ok && changes[event]) {
+			free_hook_list(&registry->events[event]);
+			registry->events[event] = lists[event];
+		} else {
+			free_hook_list(&lists[event]);
+		}
+	}
+	free(keys);
+	return ok;
+}
+
+// Remove a script's handlers, keeping the rest in the order they were registered
+void hook_unregister_script(struct hook_registry *registry, void *script) {
+	for(int i=0; i<EVENT_COUNT; i++) {
+		struct hook_list *list = &registry->events[i];
+		int kept = 0;
+		for(int j=0; j<list->count; j++)
+			if(list->handlers[j].script != script)
+				list->handlers[kept++] = list->handlers[j];
+		if(kept != list->count) {
+			list->count = kept;
+			index_handlers(list); // there are fewer now, so this always works
+		}
+	}
+}
+
+// Call every handler for an event. Handlers with a key only run when it
+// matches; HOOK_NO_KEY runs all of them. Returns how many ran
+int hook_fire(struct hook_registry *registry, int event, int key, hook_callback call, void *context) {
+	if(event < 0 || event >= EVENT_COUNT)
+		return 0;
+	struct hook_list *list = &registry->events[event];
+	if(key == HOOK_NO_KEY) {
+		for(int i=0; i<list->count; i++)
+			call(list->handlers[i].script, list->handlers[i].function, context);
+		return list->count;
+	}
+	// a key past the end of key_starts has no handlers for this event
+	if(key < 0 || key + 1 >= list->key_slots)
+		return 0;
+	int start = list->key_starts[key], end = list->key_starts[key + 1];
+	for(int i=start; i<end; i++)
+		call(list->by_key[i].script, list->by_key[i].function, context);
+	return end - start;
+}
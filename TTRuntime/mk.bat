@@ -0,0 +1,2 @@
+gcc -c profile.c fuel.c timer.c hooks.c cmdbuf.c reload.c region.c -O2 -DTTR_PROFILE
+gcc bench.c profile.c fuel.c timer.c cmdbuf.c hooks.c reload.c region.c -o ttrbench -O2 -DTTR_PROFILE
\ No newline at end of file
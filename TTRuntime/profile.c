@@ -0,0 +1,220 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+// ----- STATE VARIABLES -----
+
+volatile sig_atomic_t profile_sample_due = 0;
+
+struct profile_frame profile_stack[PROFILE_MAX_DEPTH];
+int profile_depth = 0;   // may go past PROFILE_MAX_DEPTH, extra frames aren't recorded
+
+// A distinct call stack that was sampled, and how many times
+struct profile_entry {
+	unsigned int hash;
+	int depth;
+	long count;
+	struct profile_frame *frames;
+};
+
+struct profile_entry *profile_entries = NULL;
+int profile_entry_count = 0;
+int profile_entry_capacity = 0;   // always a power of two
+
+// ----- TIMER -----
+
+#ifdef _WIN32
+HANDLE profile_timer = NULL;
+
+VOID CALLBACK profile_timer_callback(PVOID parameter, BOOLEAN fired) {
+	(void)parameter;
+	(void)fired;
+	profile_sample_due = 1;
+}
+#else
+void profile_signal(int signal_number) {
+	(void)signal_number;
+	profile_sample_due = 1;
+}
+#endif
+
+// Start taking samples, using CPU time on systems that can measure it. Returns 0 on failure
+int profile_start(int samples_per_second) {
+	if(samples_per_second <= 0)
+		return 0;
+	int period_us = 1000000 / samples_per_second;
+#ifdef _WIN32
+	int period_ms = period_us / 1000 ? period_us / 1000 : 1;
+	return CreateTimerQueueTimer(&profile_timer, NULL, profile_timer_callback, NULL, period_ms, period_ms, WT_EXECUTEDEFAULT) != 0;
+#else
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = profile_signal;
+	action.sa_flags = SA_RESTART;
+	if(sigaction(SIGPROF, &action, NULL))
+		return 0;
+	struct itimerval timer;
+	timer.it_interval.tv_sec = period_us / 1000000;
+	timer.it_interval.tv_usec = period_us % 1000000;
+	timer.it_value = timer.it_interval;
+	return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#endif
+}
+
+// Stop taking samples; the samples taken so far are kept
+void profile_stop() {
+#ifdef _WIN32
+	if(profile_timer)
+		DeleteTimerQueueTimer(NULL, profile_timer, INVALID_HANDLE_VALUE);
+	profile_timer = NULL;
+#else
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_IGN);
+#endif
+	profile_sample_due = 0;
+}
+
+// ----- CALL STACK -----
+
+// A script function was called; call_line is the line in the caller that called it
+void profile_enter(const char *script, const char *function, int call_line) {
+	if(profile_depth && profile_depth <= PROFILE_MAX_DEPTH)
+		profile_stack[profile_depth-1].line = call_line;
+	if(profile_depth < PROFILE_MAX_DEPTH) {
+		profile_stack[profile_depth].script = script;
+		profile_stack[profile_depth].function = function;
+		profile_stack[profile_depth].line = 0;
+	}
+	profile_depth++;
+}
+
+// The current script function returned
+void profile_leave() {
+	if(profile_depth)
+		profile_depth--;
+}
+
+// ----- SAMPLES -----
+
+unsigned int hash_stack(struct profile_frame *frames, int depth) {
+	unsigned int hash = 2166136261u;
+	for(int i=0; i<depth; i++) {
+		hash = (hash ^ (unsigned int)(size_t)frames[i].script) * 16777619u;
+		hash = (hash ^ (unsigned int)(size_t)frames[i].function) * 16777619u;
+		hash = (hash ^ (unsigned int)frames[i].line) * 16777619u;
+	}
+	return hash;
+}
+
+// Finds the slot for a stack in the hash table, empty if it's not there yet
+struct profile_entry *find_entry(unsigned int hash, struct profile_frame *frames, int depth) {
+	int mask = profile_entry_capacity - 1;
+	for(int slot = hash & mask;; slot = (slot + 1) & mask) {
+		struct profile_entry *entry = &profile_entries[slot];
+		if(!entry->frames)
+			return entry;
+		if(entry->hash == hash && entry->depth == depth && !memcmp(entry->frames, frames, depth * sizeof(struct profile_frame)))
+			return entry;
+	}
+}
+
+// Make the hash table twice as big
+void grow_entries() {
+	struct profile_entry *old_entries = profile_entries;
+	int old_capacity = profile_entry_capacity;
+
+	profile_entry_capacity = old_capacity ? old_capacity * 2 : 1024;
+	profile_entries = (struct profile_entry*)calloc(profile_entry_capacity, sizeof(struct profile_entry));
+	if(!profile_entries) {
+		// keep the old table and give up on growing
+		profile_entries = old_entries;
+		profile_entry_capacity = old_capacity;
+		return;
+	}
+	for(int i=0; i<old_capacity; i++)
+		if(old_entries[i].frames)
+			*find_entry(old_entries[i].hash, old_entries[i].frames, old_entries[i].depth) = old_entries[i];
+	free(old_entries);
+}
+
+// A sample point was reached while a sample was due; line is the line it's on
+void profile_sample(int line) {
+	profile_sample_due = 0;
+	if(!profile_depth)
+		return;
+	int depth = profile_depth < PROFILE_MAX_DEPTH ? profile_depth : PROFILE_MAX_DEPTH;
+	if(profile_depth <= PROFILE_MAX_DEPTH)
+		profile_stack[depth-1].line = line;
+
+	if((profile_entry_count + 1) * 4 >= profile_entry_capacity * 3)
+		grow_entries();
+	if(!profile_entry_capacity)
+		return;
+
+	unsigned int hash = hash_stack(profile_stack, depth);
+	struct profile_entry *entry = find_entry(hash, profile_stack, depth);
+	if(!entry->frames) {
+		entry->frames = (struct profile_frame*)malloc(depth * sizeof(struct profile_frame));
+		if(!entry->frames)
+			return;
+		memcpy(entry->frames, profile_stack, depth * sizeof(struct profile_frame));
+		entry->hash = hash;
+		entry->depth = depth;
+		profile_entry_count++;
+	}
+	entry->count++;
+}
+
+// Writes every sampled stack in the folded format flamegraph.pl reads:
+// "script;function:line;function:line count", one stack per line
+void profile_write_folded(FILE *out) {
+	for(int i=0; i<profile_entry_capacity; i++) {
+		struct profile_entry *entry = &profile_entries[i];
+		if(!entry->frames)
+			continue;
+		const char *script = NULL;
+		for(int j=0; j<entry->depth; j++) {
+			struct profile_frame *frame = &entry->frames[j];
+			// a new root frame whenever the call goes into another script
+			if(!script || strcmp(script, frame->script)) {
+				fprintf(out, "%s%s", j ? ";" : "", frame->script);
+				script = frame->script;
+			}
+			fprintf(out, ";%s:%d", frame->function, frame->line);
+		}
+		fprintf(out, " %ld\n", entry->count);
+	}
+}
+
+// Forget all samples taken so far
+void profile_clear() {
+	for(int i=0; i<profile_entry_capacity; i++)
+		free(profile_entries[i].frames);
+	free(profile_entries);
+	profile_entries = NULL;
+	profile_entry_count = 0;
+	profile_entry_capacity = 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+struct heap_counters heap_counters;
+
+// ----- REGIONS -----
+
+void region_init(struct region *region) {
+	memset(region, 0, sizeof(struct region));
+}
+
+void free_blocks(struct region_block *block) {
+	while(block) {
+		struct region_block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+// Let go of the heap values region lists were holding on to
+void release_holds(struct region *region) {
+	for(struct region_hold *hold = region->holds; hold; hold = hold->next)
+		value_release(hold->value);
+	region->holds = NULL;
+}
+
+void region_free(struct region *region) {
+	release_holds(region);
+	free_blocks(region->blocks);
+	free_blocks(region->spare);
+	memset(region, 0, sizeof(struct region));
+}
+
+// Get memory that lasts until the next region_reset(). Returns NULL if there's no memory
+void *region_alloc(struct region *region, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+	struct region_block *block = region->blocks;
+	if(!block || block->used + size > block->size) {
+		if(region->spare && size <= region->spare->size) {
+			block = region->spare;
+			region->spare = block->next;
+		} else {
+			size_t block_size = size > REGION_BLOCK_SIZE ? size : REGION_BLOCK_SIZE;
+			block = (struct region_block*)malloc(sizeof(struct region_block) + block_size);
+			if(!block)
+				return NULL;
+			block->size = block_size;
+			region->block_allocations++;
+		}
+		block->used = 0;
+		block->next = region->blocks;
+		region->blocks = block;
+	}
+	void *memory = block->data + block->used;
+	block->used += size;
+	region->bytes += size;
+	return memory;
+}
+
+// Free everything in the region at once. The blocks are kept for next time
+void region_reset(struct region *region) {
+	release_holds(region);
+	struct region_block *block = region->blocks;
+	while(block) {
+		struct region_block *next = block->next;
+		block->next = region->spare;
+		region->spare = block;
+		block = next;
+	}
+	region->blocks = NULL;
+	region->bytes = 0;
+}
+
+// ----- HEAP -----
+
+void *heap_alloc(size_t size) {
+	heap_counters.allocations++;
+	return malloc(size);
+}
+
+void heap_free(void *memory) {
+	heap_counters.frees++;
+	free(memory);
+}
+
+// ----- VALUES -----
+
+// Make an empty list, in the region or on the heap if region is NULL
+struct script_list *list_new(struct region *region, int capacity) {
+	if(capacity < LIST_START_SIZE)
+		capacity = LIST_START_SIZE;
+	struct script_list *list;
+	if(region) {
+		list = (struct script_list*)region_alloc(region, sizeof(struct script_list));
+		if(!list)
+			return NULL;
+		list->items = (struct script_value*)region_alloc(region, capacity * sizeof(struct script_value));
+		list->refcount = REGION_OWNED;
+	} else {
+		list = (struct script_list*)heap_alloc(sizeof(struct script_list));
+		if(!list)
+			return NULL;
+		list->items = (struct script_value*)heap_alloc(capacity * sizeof(struct script_value));
+		list->refcount = 1;
+	}
+	if(!list->items) {
+		if(!region)
+			heap_free(list);
+		return NULL;
+	}
+	list->count = 0;
+	list->capacity = capacity;
+	return list;
+}
+
+// Is this a list or string with a reference count?
+int is_heap_value(struct script_value value) {
+	if(value.type == VALUE_LIST)
+		return ((struct script_list*)value.pointer)->refcount != REGION_OWNED;
+	if(value.type == VALUE_STRING)
+		return ((struct script_string*)value.pointer)->refcount != REGION_OWNED;
+	return 0;
+}
+
+// Add to the end of a list. A heap list takes a reference to what's added,
+// and a region value going into it gets promoted. A region list takes a
+// reference to a heap value too, since whatever else was holding it (like
+// a global that gets reassigned) may let go before the hook ends, and the
+// region lets go of it when it's reset. Returns 0 if there's no memory
+int list_push(struct region *region, struct script_list *list, struct script_value value) {
+	int in_region = list->refcount == REGION_OWNED;
+	if(!in_region)
+		value = value_promote(value);
+	if(list->count == list->capacity) {
+		int capacity = list->capacity * 2;
+		struct script_value *items;
+		if(in_region) {
+			// the old items stay behind in the region until it's reset
+			items = (struct script_value*)region_alloc(region, capacity * sizeof(struct script_value));
+			if(items)
+				memcpy(items, list->items, list->count * sizeof(struct script_value));
+		} else {
+			heap_counters.allocations++;
+			heap_counters.frees++;
+			items = (struct script_value*)realloc(list->items, capacity * sizeof(struct script_value));
+		}
+		if(!items) {
+			if(!in_region)
+				value_release(value);
+			return 0;
+		}
+		list->items = items;
+		list->capacity = capacity;
+	}
+	if(in_region && is_heap_value(value)) {
+		struct region_hold *hold = (struct region_hold*)region_alloc(region, sizeof(struct region_hold));
+		if(!hold)
+			return 0;
+		value_retain(value);
+		hold->value = value;
+		hold->next = region->holds;
+		region->holds = hold;
+	}
+	list->items[list->count++] = value;
+	return 1;
+}
+
+struct script_string *string_new(struct region *region, const char *text, int length) {
+	size_t size = sizeof(struct script_string) + length + 1;
+	struct script_string *string = (struct script_string*)(region ? region_alloc(region, size) : heap_alloc(size));
+	if(!string)
+		return NULL;
+	string->refcount = region ? REGION_OWNED : 1;
+	string->length = length;
+	memcpy(string->text, text, length);
+	string->text[length] = 0;
+	return string;
+}
+
+// Reference counts only apply to heap values; region values ignore them
+void value_retain(struct script_value value) {
+	if(value.type == VALUE_LIST && ((struct script_list*)value.pointer)->refcount != REGION_OWNED)
+		((struct script_list*)value.pointer)->refcount++;
+	if(value.type == VALUE_STRING && ((struct script_string*)value.pointer)->refcount != REGION_OWNED)
+		((struct script_string*)value.pointer)->refcount++;
+}
+
+void value_release(struct script_value value) {
+	if(value.type == VALUE_LIST) {
+		struct script_list *list = (struct script_list*)value.pointer;
+		if(list->refcount == REGION_OWNED || --list->refcount)
+			return;
+		for(int i=0; i<list->count; i++)
+			value_release(list->items[i]);
+		heap_free(list->items);
+		heap_free(list);
+	} else if(value.type == VALUE_STRING) {
+		struct script_string *string = (struct script_string*)value.pointer;
+		if(string->refcount == REGION_OWNED || --string->refcount)
+			return;
+		heap_free(string);
+	}
+}
+
+// Get a heap copy of a region value, copying anything in it that's also in
+// a region. Heap values are just retained. Returns a value of VALUE_NONE if
+// there's no memory
+struct script_value value_promote(struct script_value value) {
+	struct script_value none = {VALUE_NONE};
+	if(value.type == VALUE_LIST) {
+		struct script_list *list = (struct script_list*)value.pointer;
+		if(list->refcount != REGION_OWNED) {
+			list->refcount++;
+			return value;
+		}
+		struct script_list *copy = list_new(NULL, list->count);
+		if(!copy)
+			return none;
+		for(int i=0; i<list->count; i++)
+			copy->items[i] = value_promote(list->items[i]);
+		copy->count = list->count;
+		value.pointer = copy;
+	} else if(value.type == VALUE_STRING) {
+		struct script_string *string = (struct script_string*)value.pointer;
+		if(string->refcount != REGION_OWNED) {
+			string->refcount++;
+			return value;
+		}
+		struct script_string *copy = string_new(NULL, string->text, string->length);
+		if(!copy)
+			return none;
+		value.pointer = copy;
+	}
+	return value;
+}
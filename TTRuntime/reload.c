@@ -0,0 +1,292 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+// ----- LOADING -----
+
+// Load a script for the first time, running every global's initializer
+int module_load(struct script_module *module, struct script_image *image, struct hook_registry *registry,
+	global_initializer init, void *context) {
+	memset(module, 0, sizeof(struct script_module));
+	module->image = image;
+	module->globals = (struct script_value*)calloc(image->global_count + 1, sizeof(struct script_value));
+	if(!module->globals)
+		return 0;
+	for(int i=0; i<image->global_count; i++)
+		init(module, i, context);
+	if(!hook_register_script(registry, module, image->exports, image->export_count)) {
+		free(module->globals);
+		module->globals = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+// Take a script out completely, along with its hooks, timers and globals
+void module_unload(struct script_module *module, struct hook_registry *registry, struct timer_wheel *timers) {
+	hook_unregister_script(registry, module);
+	if(timers)
+		timer_remap(timers, module, NULL, 0);
+	for(int i=0; i<module->image->global_count; i++)
+		value_release(module->globals[i]);
+	free(module->globals);
+	module->globals = NULL;
+	module->image = NULL;
+}
+
+// ----- MATCHING NAMES -----
+
+// FNV-1a
+unsigned int name_hash(const char *name) {
+	unsigned int hash = 2166136261u;
+	for(; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+// For each of the new names, find its index in the old names or -1.
+// Uses a hash table of the old names, so it's linear in the number of names
+int match_names(const char **old_names, int old_count, const char **new_names, int new_count, int *map) {
+	int size = 16;
+	while(size < old_count * 2)
+		size *= 2;
+	int *table = (int*)malloc(size * sizeof(int));
+	if(!table)
+		return 0;
+	for(int i=0; i<size; i++)
+		table[i] = -1;
+
+	for(int i=0; i<old_count; i++) {
+		unsigned int slot = name_hash(old_names[i]) & (size-1);
+		while(table[slot] >= 0)
+			slot = (slot+1) & (size-1);
+		table[slot] = i;
+	}
+	for(int i=0; i<new_count; i++) {
+		unsigned int slot = name_hash(new_names[i]) & (size-1);
+		map[i] = -1;
+		for(; table[slot] >= 0; slot = (slot+1) & (size-1)) {
+			if(!strcmp(old_names[table[slot]], new_names[i])) {
+				map[i] = table[slot];
+				break;
+			}
+		}
+	}
+	free(table);
+	return 1;
+}
+
+// ----- FUNCTION VALUES -----
+// A function value holds the function's number, so when a reload renumbers
+// the functions, the ones kept in globals, in lists they can reach, and in
+// pending timers' arguments have to be renumbered too. They're all found
+// before anything is swapped, so running out of memory partway through
+// can't leave some of them fixed and some not.
+
+struct function_refs {
+	struct script_value **values;     // function values to renumber
+	int count, capacity;
+	struct script_list **seen;        // lists already looked in, open addressing
+	int seen_count, seen_capacity;    // seen_capacity is a power of two
+};
+
+void function_refs_free(struct function_refs *refs) {
+	free(refs->values);
+	free(refs->seen);
+	memset(refs, 0, sizeof(struct function_refs));
+}
+
+// Returns 1 if the list is newly seen, 0 if it was seen before, -1 if there's no memory
+int see_list(struct function_refs *refs, struct script_list *list) {
+	if((refs->seen_count + 1) * 2 > refs->seen_capacity) {
+		int capacity = refs->seen_capacity ? refs->seen_capacity * 2 : 64;
+		struct script_list **seen = (struct script_list**)calloc(capacity, sizeof(struct script_list*));
+		if(!seen)
+			return -1;
+		for(int i=0; i<refs->seen_capacity; i++) {
+			if(!refs->seen[i])
+				continue;
+			unsigned int slot = (unsigned int)((size_t)refs->seen[i] >> 4) & (capacity-1);
+			while(seen[slot])
+				slot = (slot+1) & (capacity-1);
+			seen[slot] = refs->seen[i];
+		}
+		free(refs->seen);
+		refs->seen = seen;
+		refs->seen_capacity = capacity;
+	}
+	unsigned int slot = (unsigned int)((size_t)list >> 4) & (refs->seen_capacity-1);
+	for(; refs->seen[slot]; slot = (slot+1) & (refs->seen_capacity-1))
+		if(refs->seen[slot] == list)
+			return 0;
+	refs->seen[slot] = list;
+	refs->seen_count++;
+	return 1;
+}
+
+// Note every function value in a value, looking inside lists once each, since lists can be shared
+int find_function_refs(struct function_refs *refs, struct script_value *value) {
+	if(value->type == VALUE_FUNCTION) {
+		if(refs->count == refs->capacity) {
+			int capacity = refs->capacity ? refs->capacity * 2 : 64;
+			struct script_value **values = (struct script_value**)realloc(refs->values, capacity * sizeof(struct script_value*));
+			if(!values)
+				return 0;
+			refs->values = values;
+			refs->capacity = capacity;
+		}
+		refs->values[refs->count++] = value;
+		return 1;
+	}
+	if(value->type != VALUE_LIST)
+		return 1;
+	struct script_list *list = (struct script_list*)value->pointer;
+	int seen = see_list(refs, list);
+	if(seen <= 0)
+		return seen == 0;
+	for(int i=0; i<list->count; i++)
+		if(!find_function_refs(refs, &list->items[i]))
+			return 0;
+	return 1;
+}
+
+// The module's timer arguments
+int find_timer_function_refs(struct function_refs *refs, struct timer_wheel *wheel, void *script) {
+	for(int chunk=0; chunk<wheel->chunk_count; chunk++) {
+		for(int i=0; i<TIMER_CHUNK_SIZE; i++) {
+			struct script_timer *timer = &wheel->chunks[chunk][i];
+			if(timer->state != TIMER_PENDING || timer->script != script)
+				continue;
+			for(int j=0; j<timer->arg_count; j++)
+				if(!find_function_refs(refs, &timer->args[j]))
+					return 0;
+		}
+	}
+	return 1;
+}
+
+// Functions that are gone turn into none
+void renumber_functions(struct function_refs *refs, const int *map, int map_count) {
+	for(int i=0; i<refs->count; i++) {
+		struct script_value *value = refs->values[i];
+		long function = value->integer;
+		if(function >= 0 && function < map_count && map[function] >= 0) {
+			value->integer = map[function];
+		} else {
+			value->type = VALUE_NONE;
+			value->integer = 0;
+		}
+	}
+}
+
+// ----- RELOADING -----
+
+void reload_cancel(struct reload_plan *plan) {
+	free(plan->globals);
+	free(plan->global_map);
+	free(plan->function_map);
+	memset(plan, 0, sizeof(struct reload_plan));
+}
+
+// Work out how to get from the module's current version to a new one.
+// Returns 0 if there's no memory for it
+int reload_prepare(struct reload_plan *plan, struct script_module *module, struct script_image *image) {
+	struct script_image *old = module->image;
+	memset(plan, 0, sizeof(struct reload_plan));
+	plan->module = module;
+	plan->image = image;
+	plan->globals = (struct script_value*)calloc(image->global_count + 1, sizeof(struct script_value));
+	plan->global_map = (int*)malloc((image->global_count + 1) * sizeof(int));
+	plan->function_map = (int*)malloc((old->function_count + 1) * sizeof(int));
+
+	// the function map goes the other way, from old to new
+	if(!plan->globals || !plan->global_map || !plan->function_map
+	|| !match_names(old->global_names, old->global_count, image->global_names, image->global_count, plan->global_map)
+	|| !match_names(image->function_names, image->function_count, old->function_names, old->function_count, plan->function_map)) {
+		reload_cancel(plan);
+		return 0;
+	}
+
+	for(int i=0; i<image->global_count; i++) {
+		if(plan->global_map[i] >= 0)
+			plan->kept++;
+		else
+			plan->added++;
+	}
+	plan->dropped = old->global_count - plan->kept;
+	for(int i=0; i<old->function_count; i++)
+		if(plan->function_map[i] != i)
+			plan->functions_moved = 1;
+	return 1;
+}
+
+// Swap the new version in. Only call this between ticks, when none of the
+// module's code is running. Returns 0 if the new hooks couldn't be
+// registered or there wasn't memory to fix up function values, in which
+// case the old version stays loaded, hooks and all
+int reload_commit(struct reload_plan *plan, struct hook_registry *registry, struct timer_wheel *timers,
+	global_initializer init, void *context) {
+	struct script_module *module = plan->module;
+	struct script_image *old = module->image;
+	struct function_refs refs;
+	memset(&refs, 0, sizeof(refs));
+
+	// values are copied as they are now, not as they were when the plan was made
+	for(int i=0; i<plan->image->global_count; i++)
+		if(plan->global_map[i] >= 0)
+			plan->globals[i] = module->globals[plan->global_map[i]];
+
+	int found = 1;
+	if(plan->functions_moved) {
+		for(int i=0; found && i<plan->image->global_count; i++)
+			if(plan->global_map[i] >= 0)
+				found = find_function_refs(&refs, &plan->globals[i]);
+		if(found && timers)
+			found = find_timer_function_refs(&refs, timers, module);
+	}
+	if(!found || !hook_replace_script(registry, module, plan->image->exports, plan->image->export_count)) {
+		function_refs_free(&refs);
+		reload_cancel(plan);
+		return 0;
+	}
+	renumber_functions(&refs, plan->function_map, old->function_count);
+	function_refs_free(&refs);
+
+	// let go of the globals the new version doesn't have
+	for(int i=0; i<plan->image->global_count; i++)
+		if(plan->global_map[i] >= 0)
+			module->globals[plan->global_map[i]].type = VALUE_NONE;
+	for(int i=0; i<old->global_count; i++)
+		value_release(module->globals[i]);
+	free(module->globals);
+	module->globals = plan->globals;
+	module->image = plan->image;
+	module->generation++;
+	plan->globals = NULL;
+
+	for(int i=0; i<plan->image->global_count; i++)
+		if(plan->global_map[i] < 0)
+			init(module, i, context);
+
+	if(timers && plan->functions_moved)
+		timer_remap(timers, module, plan->function_map, old->function_count);
+
+	reload_cancel(plan);
+	return 1;
+}
@@ -0,0 +1,266 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ttr.h"
+
+// Timer IDs keep the index in the low bits and a generation count in the
+// high bits, so cancelling a timer that already ran doesn't hit a new one
+#define TIMER_INDEX_BITS  24
+#define TIMER_INDEX_MASK  ((1u << TIMER_INDEX_BITS) - 1)
+#define TIMER_MAX_CHUNKS  ((1 << TIMER_INDEX_BITS) / TIMER_CHUNK_SIZE)
+
+// ----- LISTS -----
+
+void link_init(struct timer_link *head) {
+	head->next = head->prev = head;
+}
+
+void link_insert(struct timer_link *head, struct timer_link *link) {
+	link->prev = head->prev;
+	link->next = head;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+void link_remove(struct timer_link *link) {
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->next = link->prev = link;
+}
+
+// ----- TIMER POOL -----
+
+void timer_wheel_init(struct timer_wheel *wheel, unsigned long now) {
+	memset(wheel, 0, sizeof(struct timer_wheel));
+	wheel->now = now;
+	for(int level=0; level<WHEEL_LEVELS; level++)
+		for(int slot=0; slot<WHEEL_SIZE; slot++)
+			link_init(&wheel->slots[level][slot]);
+	link_init(&wheel->overflow);
+}
+
+void timer_wheel_free(struct timer_wheel *wheel) {
+	for(int i=0; i<wheel->chunk_count; i++) {
+		// timers that never ran still hold their arguments
+		for(int j=0; j<TIMER_CHUNK_SIZE; j++)
+			if(wheel->chunks[i][j].state != TIMER_FREE)
+				for(int k=0; k<wheel->chunks[i][j].arg_count; k++)
+					value_release(wheel->chunks[i][j].args[k]);
+		free(wheel->chunks[i]);
+	}
+	free(wheel->chunks);
+	memset(wheel, 0, sizeof(struct timer_wheel));
+}
+
+// Gets a timer from the free list, allocating a whole chunk of them if it's empty
+struct script_timer *alloc_timer(struct timer_wheel *wheel) {
+	if(!wheel->free_list) {
+		if(wheel->chunk_count == TIMER_MAX_CHUNKS)
+			return NULL;
+		struct script_timer **chunks = (struct script_timer**)realloc(wheel->chunks, (wheel->chunk_count+1) * sizeof(struct script_timer*));
+		if(!chunks)
+			return NULL;
+		wheel->chunks = chunks;
+		struct script_timer *chunk = (struct script_timer*)calloc(TIMER_CHUNK_SIZE, sizeof(struct script_timer));
+		if(!chunk)
+			return NULL;
+		wheel->chunks[wheel->chunk_count] = chunk;
+
+		// push them in reverse so the lowest index comes out first
+		for(int i=TIMER_CHUNK_SIZE-1; i>=0; i--) {
+			chunk[i].id = wheel->chunk_count * TIMER_CHUNK_SIZE + i;
+			chunk[i].link.next = (struct timer_link*)wheel->free_list;
+			wheel->free_list = &chunk[i];
+		}
+		wheel->chunk_count++;
+	}
+	struct script_timer *timer = wheel->free_list;
+	wheel->free_list = (struct script_timer*)timer->link.next;
+	return timer;
+}
+
+// Also drops the timer's references to its arguments
+void free_timer(struct timer_wheel *wheel, struct script_timer *timer) {
+	for(int i=0; i<timer->arg_count; i++)
+		value_release(timer->args[i]);
+	timer->arg_count = 0;
+	timer->state = TIMER_FREE;
+	timer->id += 1u << TIMER_INDEX_BITS;
+	timer->link.next = (struct timer_link*)wheel->free_list;
+	wheel->free_list = timer;
+}
+
+// ----- WHEEL -----
+
+// Put a timer into the slot for its expiry time
+void place_timer(struct timer_wheel *wheel, struct script_timer *timer) {
+	unsigned long delta = timer->expires - wheel->now;
+	for(int level=0; level<WHEEL_LEVELS; level++) {
+		if(delta < (1ul << (WHEEL_BITS * (level+1)))) {
+			int slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			link_insert(&wheel->slots[level][slot], &timer->link);
+			return;
+		}
+	}
+	link_insert(&wheel->overflow, &timer->link);
+}
+
+// Schedule a callback to run after a number of ticks. The timer holds a
+// reference to each argument, and ones in the invocation's region are
+// promoted, since the timer outlives it. Returns an ID for timer_cancel,
+// or 0 if there are too many arguments or no memory
+unsigned int timer_add(struct timer_wheel *wheel, unsigned long delay, void *script, int function, int arg_count, struct script_value *args) {
+	if(arg_count < 0 || arg_count > TIMER_MAX_ARGS)
+		return 0;
+	struct script_timer *timer = alloc_timer(wheel);
+	if(!timer)
+		return 0;
+	for(timer->arg_count = 0; timer->arg_count < arg_count; timer->arg_count++) {
+		struct script_value *arg = &timer->args[timer->arg_count];
+		*arg = value_promote(args[timer->arg_count]);
+		if(arg->type == VALUE_NONE && args[timer->arg_count].type != VALUE_NONE) {
+			free_timer(wheel, timer);
+			return 0;
+		}
+	}
+	// a timer for right now still waits for the next tick
+	timer->expires = wheel->now + (delay ? delay : 1);
+	timer->state = TIMER_PENDING;
+	timer->script = script;
+	timer->function = function;
+	place_timer(wheel, timer);
+	wheel->pending++;
+
+	// an ID of 0 means failure, so skip over it
+	if(!timer->id)
+		timer->id += 1u << TIMER_INDEX_BITS;
+	return timer->id;
+}
+
+// Cancel a timer that hasn't run yet. Returns 1 if it was cancelled
+int timer_cancel(struct timer_wheel *wheel, unsigned int id) {
+	unsigned int index = id & TIMER_INDEX_MASK;
+	if((int)(index / TIMER_CHUNK_SIZE) >= wheel->chunk_count)
+		return 0;
+	struct script_timer *timer = &wheel->chunks[index / TIMER_CHUNK_SIZE][index % TIMER_CHUNK_SIZE];
+	if(timer->id != id || timer->state != TIMER_PENDING)
+		return 0;
+	link_remove(&timer->link);
+	free_timer(wheel, timer);
+	wheel->pending--;
+	return 1;
+}
+
+// After a script is reloaded, point its pending timers at the new function
+// numbers. map[old] is the new number, or -1 if that function is gone, in
+// which case the timer is cancelled. With no map, all of the script's timers
+// are cancelled. Returns how many were cancelled
+long timer_remap(struct timer_wheel *wheel, void *script, const int *map, int map_count) {
+	long cancelled = 0;
+	for(int chunk=0; chunk<wheel->chunk_count; chunk++) {
+		for(int i=0; i<TIMER_CHUNK_SIZE; i++) {
+			struct script_timer *timer = &wheel->chunks[chunk][i];
+			if(timer->state != TIMER_PENDING || timer->script != script)
+				continue;
+			int function = (map && timer->function >= 0 && timer->function < map_count) ? map[timer->function] : -1;
+			if(function >= 0) {
+				timer->function = function;
+				continue;
+			}
+			link_remove(&timer->link);
+			free_timer(wheel, timer);
+			wheel->pending--;
+			cancelled++;
+		}
+	}
+	return cancelled;
+}
+
+// Move every timer in a slot down to where it belongs now
+void cascade(struct timer_wheel *wheel, struct timer_link *head) {
+	struct timer_link list;
+	if(head->next == head)
+		return;
+	// take the whole list first, since timers may go right back into the same slot
+	list.next = head->next;
+	list.prev = head->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(head);
+
+	while(list.next != &list) {
+		struct script_timer *timer = (struct script_timer*)list.next;
+		link_remove(&timer->link);
+		place_timer(wheel, timer);
+	}
+}
+
+// Hand a batch of expired timers to the callback and free them
+void run_batch(struct timer_wheel *wheel, struct script_timer **batch, int count, timer_callback run, void *context) {
+	if(run)
+		run(batch, count, context);
+	for(int i=0; i<count; i++)
+		free_timer(wheel, batch[i]);
+}
+
+// Move time forward to a given tick, running everything that expires on
+// the way in batches. Returns how many timers ran
+long timer_advance(struct timer_wheel *wheel, unsigned long now, timer_callback run, void *context) {
+	struct script_timer *batch[TIMER_BATCH];
+	long ran = 0;
+
+	while(wheel->now != now) {
+		wheel->now++;
+		// don't walk ticks one by one through an empty wheel
+		if(!wheel->pending) {
+			wheel->now = now;
+			break;
+		}
+
+		// when a level wraps around, the next slot up moves down
+		unsigned long tick = wheel->now;
+		int level;
+		for(level=1; level<WHEEL_LEVELS; level++) {
+			if(tick & ((1ul << (WHEEL_BITS * level)) - 1))
+				break;
+			cascade(wheel, &wheel->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK]);
+		}
+		if(level == WHEEL_LEVELS && !(tick & ((1ul << (WHEEL_BITS * WHEEL_LEVELS)) - 1)))
+			cascade(wheel, &wheel->overflow);
+
+		struct timer_link *head = &wheel->slots[0][tick & WHEEL_MASK];
+		int count = 0;
+		while(head->next != head) {
+			struct script_timer *timer = (struct script_timer*)head->next;
+			link_remove(&timer->link);
+			timer->state = TIMER_RUNNING;
+			wheel->pending--;
+			batch[count++] = timer;
+			if(count == TIMER_BATCH) {
+				run_batch(wheel, batch, count, run, context);
+				ran += count;
+				count = 0;
+			}
+		}
+		if(count) {
+			run_batch(wheel, batch, count, run, context);
+			ran += count;
+		}
+	}
+	return ran;
+}
@@ -0,0 +1,387 @@
+/*
+ * Tilemap Town scripting runtime
+ *
+ * Copyright (C) 2018 NovaSquirrel
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include "events.h"
+
+// ----- VALUES -----
+
+enum value_type {
+	VALUE_NONE,
+	VALUE_INTEGER,
+	VALUE_REAL,
+	VALUE_BOOLEAN,
+	VALUE_STRING,
+	VALUE_LIST,
+	VALUE_FUNCTION,
+};
+
+// A value a script can hold in a variable
+struct script_value {
+	int type;
+	union {
+		long integer;    // also the function's number for VALUE_FUNCTION
+		double real;
+		void *pointer;   // string or list
+	};
+};
+
+// ----- SAMPLING PROFILER -----
+// The interpreter calls PROFILE_ENTER/PROFILE_LEAVE around each function
+// and PROFILE_POINT at each sample point the compiler listed (loop back
+// edges and calls). A timer sets profile_sample_due, so a sample point
+// costs one load and branch while profiling, and nothing at all when
+// built without TTR_PROFILE.
+
+#define PROFILE_MAX_DEPTH 64
+
+// One level of the script call stack
+struct profile_frame {
+	const char *script;
+	const char *function;
+	int line;             // line currently running in this function
+};
+
+#ifdef TTR_PROFILE
+#define PROFILE_ENTER(script, function, call_line) profile_enter(script, function, call_line)
+#define PROFILE_LEAVE()                            profile_leave()
+#define PROFILE_POINT(line)                        do { if(profile_sample_due) profile_sample(line); } while(0)
+#else
+#define PROFILE_ENTER(script, function, call_line) ((void)0)
+#define PROFILE_LEAVE()                            ((void)0)
+#define PROFILE_POINT(line)                        ((void)0)
+#endif
+
+int profile_start(int samples_per_second);
+void profile_stop();
+void profile_enter(const char *script, const char *function, int call_line);
+void profile_leave();
+void profile_sample(int line);
+void profile_write_folded(FILE *out);
+void profile_clear();
+
+extern volatile sig_atomic_t profile_sample_due;
+
+// ----- FUEL -----
+// Each hook invocation gets a budget of steps. FUEL_CHECK goes at the same
+// sample points as PROFILE_POINT and charges the step count the compiler
+// worked out for that point. Functions with a known worst case cost can
+// be paid for up front with fuel_prepay() and run with no checks at all.
+
+enum fuel_policy {
+	FUEL_ABORT,  // longjmp back to the invocation when the budget runs out
+	FUEL_YIELD,  // just mark the tank as empty, the interpreter suspends the hook
+};
+
+struct fuel_tank {
+	long remaining;
+	int policy;
+	int empty;         // set when the budget ran out
+	jmp_buf *abort_to; // where FUEL_ABORT jumps to, with a value of 1
+};
+
+#define FUEL_CHECK(tank, steps) do { if(((tank)->remaining -= (steps)) < 0) fuel_empty(tank); } while(0)
+
+void fuel_fill(struct fuel_tank *tank, long budget, int policy, jmp_buf *abort_to);
+int fuel_prepay(struct fuel_tank *tank, long worst_case_steps);
+void fuel_empty(struct fuel_tank *tank);
+
+// ----- TIMERS -----
+// @timer callbacks are kept in a hierarchical timing wheel, so scheduling,
+// cancelling and expiring are all O(1). The wheel has no clock of its own:
+// time only moves when timer_advance() is called with a new tick number,
+// so tests can drive it with a fake clock and get the same result every run.
+// A timer holds references to its arguments until it runs or is cancelled.
+
+#define WHEEL_BITS       6
+#define WHEEL_SIZE       (1 << WHEEL_BITS)
+#define WHEEL_MASK       (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS     4
+#define TIMER_MAX_ARGS   6      // arguments are stored in the timer itself
+#define TIMER_CHUNK_SIZE 4096   // timers are allocated this many at a time
+#define TIMER_BATCH      256    // most expired timers handed to the callback at once
+
+enum timer_state {
+	TIMER_FREE,
+	TIMER_PENDING,
+	TIMER_RUNNING,
+};
+
+struct timer_link {
+	struct timer_link *next, *prev;
+};
+
+struct script_timer {
+	struct timer_link link;          // must be first
+	unsigned long expires;           // tick to run on
+	unsigned int id;                 // index and generation, for timer_cancel
+	int state;
+	void *script;                    // which script to call back into
+	int function;                    // which function in it
+	int arg_count;
+	struct script_value args[TIMER_MAX_ARGS];
+};
+
+// Runs a batch of expired timers; they're freed once it returns, along with
+// their references to their arguments
+typedef void (*timer_callback)(struct script_timer **timers, int count, void *context);
+
+struct timer_wheel {
+	unsigned long now;
+	struct timer_link slots[WHEEL_LEVELS][WHEEL_SIZE];
+	struct timer_link overflow;      // timers too far off for the top level
+	struct script_timer **chunks;
+	int chunk_count;
+	struct script_timer *free_list;  // linked through link.next
+	long pending;
+};
+
+void timer_wheel_init(struct timer_wheel *wheel, unsigned long now);
+void timer_wheel_free(struct timer_wheel *wheel);
+unsigned int timer_add(struct timer_wheel *wheel, unsigned long delay, void *script, int function, int arg_count, struct script_value *args);
+int timer_cancel(struct timer_wheel *wheel, unsigned int id);
+long timer_advance(struct timer_wheel *wheel, unsigned long now, timer_callback run, void *context);
+long timer_remap(struct timer_wheel *wheel, void *script, const int *map, int map_count);
+
+// ----- HOOKS -----
+// The compiler lists the hooks each script has by event ID, so the host
+// can register them once when a script loads. Firing an event then walks
+// one array of handlers instead of looking up a function name in every
+// script. Scripts should only be registered and unregistered between
+// events, never from inside a hook_fire() callback.
+//
+// Keyed events like use_item_bomb also keep their handlers grouped by key,
+// so firing one only looks at the handlers for that key, and key names are
+// found with a hash table.
+
+#define HOOK_NO_KEY 0
+
+// One entry in a script's export table, as the compiler made it
+struct hook_export {
+	int event;
+	const char *key;   // item name for use item hooks, otherwise NULL
+	int function;
+};
+
+struct hook_handler {
+	void *script;
+	int function;
+	int key;           // from hook_key(), or HOOK_NO_KEY
+};
+
+struct hook_list {
+	struct hook_handler *handlers;   // in the order they were registered
+	int count, capacity;
+	struct hook_handler *by_key;     // the same ones grouped by key, in the same order
+	int *key_starts;                 // key k's are by_key[key_starts[k]] up to key_starts[k+1]
+	int key_slots;                   // keys key_starts has room for, plus one
+	int by_key_capacity;
+};
+
+struct hook_registry {
+	struct hook_list events[EVENT_COUNT];
+	char **keys;       // key names, so keys[id-1] is the name for key id
+	int key_count, key_capacity;
+	int *key_table;    // key IDs by hash of their name, 0 for empty slots
+	int key_table_size;
+};
+
+typedef void (*hook_callback)(void *script, int function, void *context);
+
+void hook_registry_init(struct hook_registry *registry);
+void hook_registry_free(struct hook_registry *registry);
+int hook_key(struct hook_registry *registry, const char *name, int create);
+int hook_register_script(struct hook_registry *registry, void *script, struct hook_export *exports, int count);
+int hook_replace_script(struct hook_registry *registry, void *script, struct hook_export *exports, int count);
+void hook_unregister_script(struct hook_registry *registry, void *script);
+int hook_fire(struct hook_registry *registry, int event, int key, hook_callback call, void *context);
+
+// ----- COMMAND BUFFER -----
+// Builtins that change the map don't cross into the host right away. They
+// get recorded in the invocation's command buffer, which is handed to the
+// host in one go when the hook ends. A builtin that reads the map calls
+// COMMAND_BEFORE_QUERY with the parts of the world it looks at, and the
+// buffer is flushed first if anything in it changes those, so it always
+// sees the changes the script made before it. @player_at_xy after a run of
+// @obj_add calls doesn't have to flush anything.
+//
+// Recorded commands hold references to their arguments, which are released
+// after apply returns, so the host has to retain anything it keeps.
+
+#define COMMAND_MAX_ARGS     3
+#define COMMAND_BUFFER_LIMIT 4096  // flush early past this many commands
+
+enum command_kind {
+	COMMAND_TILE_PUT,
+	COMMAND_OBJ_ADD,
+	COMMAND_OBJ_REMOVE,
+	COMMAND_PLAYER_MOVE,
+};
+
+// Parts of the world a command changes or a query reads
+enum world_part {
+	WORLD_TILES   = 1,
+	WORLD_OBJECTS = 2,
+	WORLD_PLAYERS = 4,
+};
+
+struct host_command {
+	int kind;
+	struct script_value args[COMMAND_MAX_ARGS];
+};
+
+// Applies a batch of commands in order; each call is one host crossing
+typedef void (*command_apply)(struct host_command *commands, int count, void *context);
+
+struct command_buffer {
+	struct host_command *commands;
+	int count, capacity;
+	command_apply apply;
+	void *context;
+	int pending;       // WORLD_ parts the recorded commands change
+	long crossings;    // times apply was called
+	long applied;      // commands handed to it
+};
+
+#define COMMAND_BEFORE_QUERY(buffer, reads) do { if((buffer)->pending & (reads)) command_flush(buffer); } while(0)
+
+void command_buffer_init(struct command_buffer *buffer, command_apply apply, void *context);
+void command_buffer_free(struct command_buffer *buffer);
+void command_record(struct command_buffer *buffer, int kind, struct script_value *args);
+void command_flush(struct command_buffer *buffer);
+void command_discard(struct command_buffer *buffer);
+
+extern const int command_changes[];
+
+// ----- HOT RELOAD -----
+// A script is reloaded in two steps. reload_prepare() matches the old
+// globals and functions up with the new ones by name, and can run while the
+// old version is still going. reload_commit() moves the globals' values over
+// and swaps in the new code; the host calls it between ticks, so no hook
+// ever sees half of each version. Other scripts aren't touched at all, and
+// the script's hooks keep their place among theirs. A module owns its
+// globals: ones the new version drops are released by reload_commit(), and
+// module_unload() releases the rest.
+
+// What the compiler makes for one script
+struct script_image {
+	const char **global_names;
+	int global_count;
+	const char **function_names;
+	void **functions;              // code for each function, for the interpreter
+	int function_count;
+	struct hook_export *exports;
+	int export_count;
+};
+
+// A loaded script
+struct script_module {
+	struct script_image *image;
+	struct script_value *globals;
+	int generation;                // goes up on every reload
+};
+
+struct reload_plan {
+	struct script_module *module;
+	struct script_image *image;
+	struct script_value *globals;  // the new globals, filled in by reload_commit
+	int *global_map;               // new global -> old global, or -1 if it's new
+	int *function_map;             // old function -> new function, or -1 if it's gone
+	int functions_moved;           // 0 if every function kept its number, so timers don't need fixing
+	int kept, added, dropped;      // globals
+};
+
+// Sets a global to its initial value, by running its initializer
+typedef void (*global_initializer)(struct script_module *module, int global, void *context);
+
+int module_load(struct script_module *module, struct script_image *image, struct hook_registry *registry,
+	global_initializer init, void *context);
+void module_unload(struct script_module *module, struct hook_registry *registry, struct timer_wheel *timers);
+int reload_prepare(struct reload_plan *plan, struct script_module *module, struct script_image *image);
+int reload_commit(struct reload_plan *plan, struct hook_registry *registry, struct timer_wheel *timers,
+	global_initializer init, void *context);
+void reload_cancel(struct reload_plan *plan);
+
+// ----- REGIONS -----
+// Lists and strings the compiler proved can't outlive a hook invocation
+// (NODE_REGION) are allocated from the invocation's region, which is just a
+// pointer bump, and all of them go away at once with region_reset() when
+// the hook returns. Everything else lives on the heap with a reference
+// count. A region value that gets stored into a heap list anyway, or passed
+// to @timer or a builtin whose command gets recorded, is copied to the heap
+// first with value_promote(), so nothing on the heap can point into a
+// region. Going the other way, a heap value in a region list is retained
+// until region_reset().
+
+#define REGION_BLOCK_SIZE 16384
+#define REGION_OWNED      -1       // refcount of anything in a region
+#define LIST_START_SIZE   4
+
+struct region_block {
+	struct region_block *next;
+	size_t size, used;
+	char data[];
+};
+
+// A heap value in a region list, which the region has a reference to
+struct region_hold {
+	struct region_hold *next;
+	struct script_value value;
+};
+
+struct region {
+	struct region_block *blocks;   // the one being allocated from is first
+	struct region_hold *holds;     // released when the region is reset
+	struct region_block *spare;    // blocks kept from the last reset
+	size_t bytes;                  // handed out since the last reset
+	long block_allocations;        // times a block had to be malloc'd
+};
+
+struct script_list {
+	int refcount;
+	int count, capacity;
+	struct script_value *items;
+};
+
+struct script_string {
+	int refcount;
+	int length;
+	char text[];
+};
+
+// Heap traffic so far, for measuring
+struct heap_counters {
+	long allocations, frees;
+};
+
+void region_init(struct region *region);
+void region_free(struct region *region);
+void *region_alloc(struct region *region, size_t size);
+void region_reset(struct region *region);
+struct script_list *list_new(struct region *region, int capacity);
+int list_push(struct region *region, struct script_list *list, struct script_value value);
+struct script_string *string_new(struct region *region, const char *text, int length);
+void value_retain(struct script_value value);
+void value_release(struct script_value value);
+struct script_value value_promote(struct script_value value);
+
+extern struct heap_counters heap_counters;